@@ -62,6 +62,12 @@ static droption_t<bool> fail_address_leaks
  "If an address leak is about to occur, i.e. via send() or write() system calls,"
  "fail the leaky system call to prevent the leak");
 
+static droption_t<unsigned int> show_origins
+(DROPTION_SCOPE_CLIENT, "show_origins", 0,
+ "Report where leaked taint came from",
+ "Record the instructions that write tainted values, and print the last N "
+ "of them with each address leak.");
+
 static app_pc exe_start;
 static bool tainted_argv;
 
@@ -76,7 +82,11 @@ dr_client_main(client_id_t id, int argc, const char *argv[])
         exe_start = exe->start;
     dr_free_module_data(exe);
 
-    drtaint_init(id);
+    drtaint_options_t ops = { sizeof(ops), DRTAINT_GRANULARITY_WORD,
+                              DRTAINT_LABELS_BITS, DRTAINT_ORIGINS_OFF };
+    if (show_origins.get_value() > 0)
+        ops.origin_mode = DRTAINT_ORIGINS_WRITE;
+    drtaint_init_ex(id, &ops);
     drmgr_init();
     drmgr_register_bb_instrumentation_event(event_bb_analysis_start,
                                             event_app_instruction_start,
@@ -200,16 +210,16 @@ taint_stack(int argc, char *argv[], char *envp[])
 {
     void *drcontext = dr_get_current_drcontext();
 
+    int envc;
+
     /* taint argv on the stack */
-    for (int i = 0; i < argc; ++i) {
-        drtaint_set_app_taint(drcontext, (app_pc)argv+i,
-                              STCK_POINTER_TAINT);
-    }
+    drtaint_set_app_taint_range(drcontext, (app_pc)argv, argc * sizeof(argv[0]),
+                                STCK_POINTER_TAINT);
     /* taint envp on the stack */
-    for (int i = 0; envp[i]; ++i) {
-        drtaint_set_app_taint(drcontext, (app_pc)envp+i,
-                              STCK_POINTER_TAINT);
-    }
+    for (envc = 0; envp[envc]; ++envc)
+        ;
+    drtaint_set_app_taint_range(drcontext, (app_pc)envp, envc * sizeof(envp[0]),
+                                STCK_POINTER_TAINT);
 }
 
 static dr_emit_flags_t
@@ -240,7 +250,9 @@ event_app_instruction_pc(void *drcontext, void *tag, instrlist_t *bb, instr_t *i
 static bool
 event_filter_syscall(void *drcontext, int sysnum)
 {
-    return true;
+    /* the sinks and the sources of heap pointers */
+    return sysnum == SYS_write || sysnum == SYS_send ||
+           sysnum == SYS_mmap2 || sysnum == SYS_brk;
 }
 
 static void
@@ -271,7 +283,12 @@ event_post_syscall(void *drcontext, int sysnum)
 static bool
 handle_address_leak(void *drcontext)
 {
+    app_pc origins[DRTAINT_ORIGINS_MAX];
+    size_t n = drtaint_get_origins(drcontext, origins, show_origins.get_value());
+
     dr_fprintf(STDERR, "[ASLR] Address leak\n");
+    for (size_t i = 0; i < n; ++i)
+        dr_fprintf(STDERR, "[ASLR]   tainted by " PFX "\n", origins[i]);
     if (fail_address_leaks.get_value()) {
         dr_syscall_set_result(drcontext, -1);
         return false;
@@ -286,13 +303,12 @@ event_pre_syscall(void *drcontext, int sysnum)
         /* we want to check these for taint */
         char *buffer = (char *)dr_syscall_get_param(drcontext, 1);
         size_t len   = dr_syscall_get_param(drcontext, 2);
+        bool tainted;
 
-        for (int i = 0; i < len; ++i) {
-            byte result;
-            if (drtaint_get_app_taint(drcontext, (app_pc)&buffer[i],
-                                      &result) && result != 0)
-                return handle_address_leak(drcontext);
-        }
+        /* a buffer we can't check might hold a leak */
+        if (!drtaint_find_tainted(drcontext, (app_pc)buffer, len, &tainted,
+                                  NULL, NULL) || tainted)
+            return handle_address_leak(drcontext);
     }
     return true;
 }
@@ -1,5 +1,6 @@
 #include "dr_api.h"
 #include "drmgr.h"
+#include "droption.h"
 
 #include "../drtaint.h"
 
@@ -11,15 +12,94 @@
 static void
 exit_event(void);
 
+static droption_t<std::string> granularity
+(DROPTION_SCOPE_CLIENT, "granularity", "word",
+ "Shadow granularity: word or byte",
+ "Track taint with one shadow byte per application word (word) or one "
+ "shadow byte per application byte (byte). Byte granularity avoids false "
+ "positives from sub-word accesses at the cost of four times the shadow memory.");
+
+static droption_t<std::string> labels
+(DROPTION_SCOPE_CLIENT, "labels", "bits",
+ "Taint values: bits or sets",
+ "Track taint as a byte of independent label bits (bits) or as 16-bit IDs of "
+ "interned label sets (sets), which allows thousands of labels.");
+
+static droption_t<bool> shadow_usage
+(DROPTION_SCOPE_CLIENT, "shadow_usage", false,
+ "Print the shadow memory in use at exit",
+ "Print the kilobytes of shadow memory allocated at exit to stderr, for the "
+ "benchmark harness.");
+
+static droption_t<std::string> stats_file
+(DROPTION_SCOPE_CLIENT, "stats_file", "",
+ "Write opcode statistics as JSON to this file",
+ "Count how often each opcode is instrumented and executed, which opcodes "
+ "drtaint skips, and the calls out of the code cache, and write the counts "
+ "as JSON to this file at exit.");
+
+static droption_t<unsigned int> profile_top
+(DROPTION_SCOPE_CLIENT, "profile_top", 0,
+ "Print the N functions and modules costliest to instrument",
+ "Measure the time, meta instructions per app instruction and drreg spills "
+ "that instrumenting each block costs, and print the N costliest functions "
+ "and modules to stderr at exit. 0 disables the profiling.");
+
+static droption_t<std::string> include
+(DROPTION_SCOPE_CLIENT, "include", "",
+ "Propagate taint only through these modules and address ranges",
+ "A comma-separated list of module names, such as libc.so.6, and address "
+ "ranges written 0xstart-0xend. When given, taint is propagated only through "
+ "code in them. Empty includes all code.");
+
+static droption_t<std::string> exclude
+(DROPTION_SCOPE_CLIENT, "exclude", "",
+ "Do not propagate taint through these modules and address ranges",
+ "A comma-separated list of module names and address ranges, as for -include, "
+ "whose code runs without taint propagation.");
+
+static droption_t<std::string> excluded_regs
+(DROPTION_SCOPE_CLIENT, "excluded_regs", "clear",
+ "Register taint on return from excluded code: clear or keep",
+ "Clear the taint of the caller-saved registers where excluded code returns to "
+ "included code (clear), treating excluded code as producing untainted results, or "
+ "leave it as it was (keep).");
+
 DR_EXPORT void
 dr_client_main(client_id_t id, int argc, const char *argv[])
 {
-    drtaint_init(id);
+    droption_parser_t::parse_argv(DROPTION_SCOPE_CLIENT, argc, argv, NULL, NULL);
+
+    drtaint_options_t ops = { sizeof(ops), DRTAINT_GRANULARITY_WORD,
+                              DRTAINT_LABELS_BITS };
+    if (granularity.get_value() == "byte")
+        ops.granularity = DRTAINT_GRANULARITY_BYTE;
+    else if (granularity.get_value() != "word")
+        DR_ASSERT_MSG(false, "unknown granularity");
+    if (labels.get_value() == "sets")
+        ops.label_mode = DRTAINT_LABELS_SETS;
+    else if (labels.get_value() != "bits")
+        DR_ASSERT_MSG(false, "unknown label mode");
+    if (!stats_file.get_value().empty())
+        ops.stats_path = stats_file.get_value().c_str();
+    ops.profile_top = profile_top.get_value();
+    if (!include.get_value().empty())
+        ops.include = include.get_value().c_str();
+    if (!exclude.get_value().empty())
+        ops.exclude = exclude.get_value().c_str();
+    if (excluded_regs.get_value() == "keep")
+        ops.excluded_policy = DRTAINT_EXCLUDED_KEEP;
+    else if (excluded_regs.get_value() != "clear")
+        DR_ASSERT_MSG(false, "unknown excluded_regs policy");
+    drtaint_init_ex(id, &ops);
     dr_register_exit_event(exit_event);
 }
 
 static void
 exit_event(void)
 {
+    size_t bytes;
+    if (shadow_usage.get_value() && drtaint_get_shadow_usage(&bytes))
+        dr_fprintf(STDERR, "drtaint shadow_kb %d\n", (int)(bytes / 1024));
     drtaint_exit();
 }
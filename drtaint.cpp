@@ -3,51 +3,175 @@
 #include "drreg.h"
 #include "drutil.h"
 
+/* Propagation has handlers for the A32/T32 encodings, and a coarser
+ * backend for x86-64 that shares the shadow memory and register layout in
+ * drtaint_shadow.c.
+ */
+#if !defined(ARM_32) && !defined(X86_64)
+# error "drtaint only propagates taint through 32-bit ARM and x86-64 code"
+#endif
+
 #include "umbra.h"
 #include "drsyscall.h"
+#include "drbbdup.h"
 #include "drtaint.h"
 #include "drtaint_shadow.h"
 #include "drtaint_helper.h"
+#include "drtaint_stats.h"
+#include "drtaint_profile.h"
+#include "drtaint_filter.h"
+
+#include <syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <string.h>
+
+static void
+event_bb_orig_analysis(void *drcontext, void *tag, instrlist_t *ilist, void *user_data,
+                       void **orig_analysis_data);
+
+static uintptr_t
+event_bb_setup(void *drbbdup_ctx, void *drcontext, void *tag, instrlist_t *ilist,
+               bool *enable_dups, bool *enable_dynamic_handling, void *user_data);
+
+static dr_emit_flags_t
+event_bb_analysis(void *drcontext, void *tag, instrlist_t *ilist, bool for_trace,
+                  bool translating, uintptr_t encoding, void *user_data,
+                  void *orig_analysis_data, void **case_analysis_data);
+
+static void
+event_bb_analysis_free(void *drcontext, uintptr_t encoding, void *user_data,
+                       void *orig_analysis_data, void *case_analysis_data);
 
 static dr_emit_flags_t
-event_app_instruction(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where,
-                      bool for_trace, bool translating, void *user_data);
+event_app_instruction(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                      instr_t *where, bool for_trace, bool translating,
+                      uintptr_t encoding, void *user_data, void *orig_analysis_data,
+                      void *case_analysis_data);
 
 static bool
-event_pre_syscall(void *drcontext, int sysnum);
+syscall_table_init(void);
 
 static void
 event_post_syscall(void *drcontext, int sysnum);
 
+static void
+shadow_fwd_flush_at(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t reg);
+
+#ifdef X86_64
+static dr_emit_flags_t
+event_app2app(void *drcontext, void *tag, instrlist_t *ilist, bool for_trace,
+              bool translating);
+#endif
+
+/* Each block has an uninstrumented copy, used while the per-thread register
+ * summary says no register is tainted, and the instrumented default copy.
+ * A block in excluded code has only its default copy, which propagates
+ * nothing.
+ */
+enum {
+    DRTAINT_CASE_CLEAN    = 0,
+    DRTAINT_CASE_TAINTED  = 1,
+    DRTAINT_CASE_EXCLUDED = 2,
+};
+
 static int drtaint_init_count;
 
 static client_id_t client_id;
 
+static bool record_origins;
+
+static drtaint_excluded_policy_t excluded_policy;
+
+static bool no_forwarding;
+
+/* the shadow register forwarding state of the block being instrumented */
+static int fwd_tls = -1;
+
+/* Threads share the program break, so its tracking is serialized */
+static void *brk_lock;
+
 bool
 drtaint_init(client_id_t id)
+{
+    drtaint_options_t ops = { sizeof(ops), DRTAINT_GRANULARITY_WORD,
+                              DRTAINT_LABELS_BITS, DRTAINT_ORIGINS_OFF, NULL, 0,
+                              NULL, NULL, DRTAINT_EXCLUDED_CLEAR, false };
+    return drtaint_init_ex(id, &ops);
+}
+
+bool
+drtaint_init_ex(client_id_t id, const drtaint_options_t *ops)
 {
     drreg_options_t drreg_ops = {sizeof(drreg_ops), 4, false};
     drsys_options_t drsys_ops = {sizeof(drsys_ops), 0};
-    drmgr_priority_t pri = {sizeof(pri),
-        DRMGR_PRIORITY_NAME_DRTAINT, NULL, NULL,
-        DRMGR_PRIORITY_INSERT_DRTAINT};
+    drbbdup_options_t drbbdup_ops = {sizeof(drbbdup_ops), };
+    /* r0's shadow is cleared before other clients taint a syscall's result */
+    drmgr_priority_t syscall_priority = {
+        sizeof(syscall_priority), DRMGR_PRIORITY_NAME_DRTAINT_SYSCALL, NULL, NULL,
+        DRMGR_PRIORITY_POST_SYSCALL_DRTAINT};
+#ifdef X86_64
+    /* rep strings are expanded before drbbdup copies the block */
+    drmgr_priority_t app2app_priority = {
+        sizeof(app2app_priority), DRMGR_PRIORITY_NAME_DRTAINT, NULL, NULL,
+        DRMGR_PRIORITY_APP2APP_DRBBDUP - 1};
+#endif
+    drtaint_options_t full_ops = { sizeof(full_ops), DRTAINT_GRANULARITY_WORD,
+                                   DRTAINT_LABELS_BITS, DRTAINT_ORIGINS_OFF,
+                                   NULL, 0, NULL, NULL, DRTAINT_EXCLUDED_CLEAR,
+                                   false };
     int count = dr_atomic_add32_return_sum(&drtaint_init_count, 1);
     if (count > 1)
         return true;
 
     client_id = id;
     drmgr_init();
-    if (!drtaint_shadow_init(id) ||
+    /* callers built against an older drtaint_options_t get the defaults */
+    memcpy(&full_ops, ops, ops->struct_size < sizeof(full_ops) ?
+           ops->struct_size : sizeof(full_ops));
+    full_ops.struct_size = sizeof(full_ops);
+    record_origins = full_ops.origin_mode != DRTAINT_ORIGINS_OFF;
+    /* recording an origin takes two more registers wherever a value is stored */
+    if (record_origins)
+        drreg_ops.num_spill_slots += 2;
+#ifdef X86_64
+    /* x86 propagation holds the flags as well */
+    drreg_ops.num_spill_slots += 1;
+#endif
+    excluded_policy = full_ops.excluded_policy;
+    no_forwarding = full_ops.no_forwarding;
+    brk_lock = dr_mutex_create();
+    if (!drtaint_shadow_init(id, &full_ops) ||
         drreg_init(&drreg_ops) != DRREG_SUCCESS ||
-        drsys_init(id, &drsys_ops) != DRMF_SUCCESS)
+        drsys_init(id, &drsys_ops) != DRMF_SUCCESS ||
+        !syscall_table_init() ||
+        !drreg_block_scratch_init() ||
+        (fwd_tls = drmgr_register_tls_field()) == -1 ||
+        !drtaint_filter_init(full_ops.include, full_ops.exclude) ||
+        !drtaint_stats_init(full_ops.stats_path) ||
+        !drtaint_profile_init(full_ops.profile_top))
+        return false;
+
+    drbbdup_ops.set_up_bb_dups         = event_bb_setup;
+    /* The summary is kept current where registers may become tainted, so
+     * dispatch is a single load of it.
+     */
+    drbbdup_ops.insert_encode          = NULL;
+    drbbdup_ops.analyze_orig           = event_bb_orig_analysis;
+    drbbdup_ops.analyze_case_ex        = event_bb_analysis;
+    drbbdup_ops.destroy_case_analysis  = event_bb_analysis_free;
+    drbbdup_ops.instrument_instr_ex    = event_app_instruction;
+    drbbdup_ops.runtime_case_opnd      =
+        drtaint_shadow_reg_summary_opnd(dr_get_current_drcontext());
+    drbbdup_ops.non_default_case_limit = 1;
+    if (drbbdup_init(&drbbdup_ops) != DRBBDUP_SUCCESS ||
+        !drmgr_register_post_syscall_event_ex(event_post_syscall, &syscall_priority))
         return false;
-    drsys_filter_all_syscalls();
-    if (!drmgr_register_bb_instrumentation_event(NULL,
-                                                 event_app_instruction,
-                                                 &pri) ||
-        !drmgr_register_pre_syscall_event(event_pre_syscall) ||
-        !drmgr_register_post_syscall_event(event_post_syscall))
+#ifdef X86_64
+    if (!drutil_init() ||
+        !drmgr_register_bb_app2app_event(event_app2app, &app2app_priority))
         return false;
+#endif
     return true;
 }
 
@@ -57,9 +181,19 @@ drtaint_exit(void)
     int count = dr_atomic_add32_return_sum(&drtaint_init_count, -1);
     if (count != 0)
         return;
-    drmgr_unregister_pre_syscall_event(event_pre_syscall);
+#ifdef X86_64
+    drmgr_unregister_bb_app2app_event(event_app2app);
+    drutil_exit();
+#endif
     drmgr_unregister_post_syscall_event(event_post_syscall);
+    drbbdup_exit();
+    drtaint_stats_exit();
+    drtaint_profile_exit();
+    drtaint_filter_exit();
+    drmgr_unregister_tls_field(fwd_tls);
+    drreg_block_scratch_exit();
     drtaint_shadow_exit();
+    dr_mutex_destroy(brk_lock);
     drmgr_exit();
     drreg_exit();
     drsys_exit();
@@ -77,6 +211,7 @@ bool
 drtaint_insert_reg_to_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
                             reg_id_t shadow, reg_id_t regaddr)
 {
+    shadow_fwd_flush_at(drcontext, ilist, where, shadow);
     return drtaint_shadow_insert_reg_to_shadow(drcontext, ilist, where,
                                                shadow, regaddr);
 }
@@ -85,6 +220,7 @@ bool
 drtaint_insert_reg_to_taint_load(void *drcontext, instrlist_t *ilist, instr_t *where,
                                  reg_id_t shadow, reg_id_t regaddr)
 {
+    shadow_fwd_flush_at(drcontext, ilist, where, shadow);
     return drtaint_shadow_insert_reg_to_shadow_load(drcontext, ilist, where,
                                                     shadow, regaddr);
 }
@@ -92,7 +228,11 @@ drtaint_insert_reg_to_taint_load(void *drcontext, instrlist_t *ilist, instr_t *w
 bool
 drtaint_get_reg_taint(void *drcontext, reg_id_t reg, byte *result)
 {
-    return drtaint_shadow_get_reg_taint(drcontext, reg, result);
+    uint label;
+    if (!drtaint_shadow_get_reg_taint(drcontext, reg, &label))
+        return false;
+    *result = (byte)label;
+    return true;
 }
 
 bool
@@ -104,7 +244,11 @@ drtaint_set_reg_taint(void *drcontext, reg_id_t reg, byte value)
 bool
 drtaint_get_app_taint(void *drcontext, app_pc app, byte *result)
 {
-    return drtaint_shadow_get_app_taint(drcontext, app, result);
+    uint label;
+    if (!drtaint_shadow_get_app_taint(drcontext, app, &label))
+        return false;
+    *result = (byte)label;
+    return true;
 }
 
 bool
@@ -113,217 +257,529 @@ drtaint_set_app_taint(void *drcontext, app_pc app, byte result)
     return drtaint_shadow_set_app_taint(drcontext, app, result);
 }
 
+bool
+drtaint_get_reg_label(void *drcontext, reg_id_t reg, uint *label)
+{
+    return drtaint_shadow_get_reg_taint(drcontext, reg, label);
+}
+
+bool
+drtaint_set_reg_label(void *drcontext, reg_id_t reg, uint label)
+{
+    return drtaint_shadow_set_reg_taint(drcontext, reg, label);
+}
+
+bool
+drtaint_get_app_label(void *drcontext, app_pc app, uint *label)
+{
+    return drtaint_shadow_get_app_taint(drcontext, app, label);
+}
+
+bool
+drtaint_set_app_label(void *drcontext, app_pc app, uint label)
+{
+    return drtaint_shadow_set_app_taint(drcontext, app, label);
+}
+
+bool
+drtaint_set_app_label_range(void *drcontext, app_pc start, size_t size, uint label)
+{
+    return drtaint_shadow_set_app_taint_range(drcontext, start, size, label);
+}
+
+bool
+drtaint_get_app_taint_range(void *drcontext, app_pc start, size_t size, byte *result)
+{
+    return drtaint_shadow_get_app_taint_range(drcontext, start, size, result);
+}
+
+bool
+drtaint_get_app_taint_union(void *drcontext, app_pc start, size_t size, byte *label)
+{
+    return drtaint_shadow_get_app_taint_union(drcontext, start, size, label);
+}
+
+bool
+drtaint_find_tainted(void *drcontext, app_pc start, size_t size, bool *found,
+                     app_pc *first_tainted, byte *label)
+{
+    uint value;
+    /* a label set ID doesn't fit in a byte */
+    if (drtaint_shadow_label_size() != 1 ||
+        !drtaint_shadow_find_tainted(drcontext, start, size, found, first_tainted,
+                                     &value))
+        return false;
+    if (*found && label != NULL)
+        *label = (byte)value;
+    return true;
+}
+
+bool
+drtaint_get_shadow_usage(size_t *bytes)
+{
+    return drtaint_shadow_get_usage(bytes);
+}
+
+size_t
+drtaint_get_origins(void *drcontext, app_pc *pcs, size_t max)
+{
+    return drtaint_shadow_get_origins(drcontext, pcs, max);
+}
+
+bool
+drtaint_set_app_taint_range(void *drcontext, app_pc start, size_t size, byte value)
+{
+    return drtaint_shadow_set_app_taint_range(drcontext, start, size, value);
+}
+
+/* ======================================================================================
+ * shadow register forwarding
+ * ==================================================================================== */
+/* Within a run of unpredicated instructions that can't fault, branch or
+ * make a syscall, the shadow values last written to shadow registers are
+ * kept in a couple of block scratch registers. They are written back to
+ * per_thread_t only when evicted and at the end of the run: before a
+ * predicated instruction, a memory access or trap, a branch or a syscall,
+ * and at the block's exit. Reading a forwarded shadow register is then a
+ * register move.
+ *
+ * pc is never forwarded, as clients write its shadow themselves. Callouts
+ * within a run only compute label set unions and never read shadow
+ * registers, so they need no write-back. Another client's inline access
+ * through drtaint_insert_reg_to_taint() ends the run where it is inserted,
+ * and clients reading register taint from clean calls turn forwarding off
+ * with drtaint_options_t.no_forwarding. Runs also end before every
+ * instruction that may fault, see instr_may_fault(), so nothing is held in
+ * a holder when a fault is delivered to the app, and per_thread_t is
+ * current for its handler and after it.
+ */
+#define FWD_NUM_HOLDERS 2
+
+/* the register whose shadow clients set, which x86 doesn't have */
+#ifdef ARM_32
+# define FWD_CLIENT_REG DR_REG_PC
+#else
+# define FWD_CLIENT_REG DR_REG_NULL
+#endif
+
+typedef struct _shadow_fwd_t {
+    /* whether the instruction being instrumented may forward */
+    bool enabled;
+    int num_holders;
+    reg_id_t holder[FWD_NUM_HOLDERS];
+    /* the shadow register each holder has, or DR_REG_NULL */
+    reg_id_t app[FWD_NUM_HOLDERS];
+    bool dirty[FWD_NUM_HOLDERS];
+    uint used[FWD_NUM_HOLDERS];
+    uint clock;
+    /* the per_thread_t base, held over the block */
+    reg_id_t sbase;
+    /* the app instruction being instrumented, recorded as an origin */
+    app_pc pc;
+} shadow_fwd_t;
+
+static shadow_fwd_t *
+shadow_fwd_active(void *drcontext)
+{
+    shadow_fwd_t *fwd = (shadow_fwd_t *)drmgr_get_tls_field(drcontext, fwd_tls);
+    return fwd != NULL && fwd->enabled ? fwd : NULL;
+}
+
+static int
+shadow_fwd_find(shadow_fwd_t *fwd, reg_id_t reg)
+{
+    for (int i = 0; i < fwd->num_holders; i++) {
+        if (fwd->app[i] == reg)
+            return i;
+    }
+    return -1;
+}
+
+static void
+shadow_fwd_write_back(void *drcontext, shadow_fwd_t *fwd, instrlist_t *ilist,
+                      instr_t *where, reg_id_t sbase, int i)
+{
+    if (fwd->app[i] != DR_REG_NULL && fwd->dirty[i]) {
+        drtaint_shadow_insert_reg_to_shadow_store_ex(drcontext, ilist, where,
+                                                     fwd->app[i], sbase,
+                                                     fwd->holder[i]);
+    }
+    fwd->app[i] = DR_REG_NULL;
+    fwd->dirty[i] = false;
+}
+
+/* Writes back every forwarded value, ending the run */
+static void
+shadow_fwd_flush(void *drcontext, shadow_fwd_t *fwd, instrlist_t *ilist,
+                 instr_t *where, reg_id_t sbase)
+{
+    for (int i = 0; i < fwd->num_holders; i++)
+        shadow_fwd_write_back(drcontext, fwd, ilist, where, sbase, i);
+}
+
+/* Ends the run of the block being instrumented, if any, at where. This is
+ * for code inserted by other clients, so the run need not be enabled.
+ */
+static void
+shadow_fwd_flush_at(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t reg)
+{
+    shadow_fwd_t *fwd = (shadow_fwd_t *)drmgr_get_tls_field(drcontext, fwd_tls);
+
+    /* pc's slot is always current, so accessing it keeps the run going */
+    if (fwd != NULL && reg != FWD_CLIENT_REG)
+        shadow_fwd_flush(drcontext, fwd, ilist, where, fwd->sbase);
+}
+
+static void
+insert_shadow_reg_load(void *drcontext, instrlist_t *ilist, instr_t *where,
+                       reg_id_t reg, reg_id_t sbase, reg_id_t dst)
+{
+    shadow_fwd_t *fwd = shadow_fwd_active(drcontext);
+    int i = fwd == NULL ? -1 : shadow_fwd_find(fwd, reg);
+
+    if (i < 0) {
+        drtaint_shadow_insert_reg_to_shadow_load_ex(drcontext, ilist, where, reg,
+                                                    sbase, dst);
+        return;
+    }
+    fwd->used[i] = ++fwd->clock;
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                             (drcontext,
+                              opnd_create_reg(dst),
+                              opnd_create_reg(fwd->holder[i])));
+}
+
+/* Records the instruction being instrumented as an origin if the shadow
+ * value it is about to store, in value, is nonzero.
+ */
+static void
+insert_record_origin(void *drcontext, instrlist_t *ilist, instr_t *where,
+                     reg_id_t sbase, reg_id_t value)
+{
+    shadow_fwd_t *fwd = (shadow_fwd_t *)drmgr_get_tls_field(drcontext, fwd_tls);
+
+    if (!record_origins || fwd == NULL)
+        return;
+    auto sreg1 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+    drtaint_shadow_insert_record_origin(drcontext, ilist, where, sbase, fwd->pc, value,
+                                        sreg1, sreg2);
+}
+
+static void
+insert_shadow_reg_store(void *drcontext, instrlist_t *ilist, instr_t *where,
+                        reg_id_t reg, reg_id_t sbase, reg_id_t src)
+{
+    shadow_fwd_t *fwd = shadow_fwd_active(drcontext);
+    int i;
+
+    insert_record_origin(drcontext, ilist, where, sbase, src);
+    if (fwd == NULL || reg == FWD_CLIENT_REG) {
+        drtaint_shadow_insert_reg_to_shadow_store_ex(drcontext, ilist, where, reg,
+                                                     sbase, src);
+        return;
+    }
+    i = shadow_fwd_find(fwd, reg);
+    if (i < 0) {
+        /* take an empty holder, or else the least recently used one */
+        i = 0;
+        for (int j = 1; j < fwd->num_holders; j++) {
+            if (fwd->app[i] != DR_REG_NULL &&
+                (fwd->app[j] == DR_REG_NULL || fwd->used[j] < fwd->used[i]))
+                i = j;
+        }
+        shadow_fwd_write_back(drcontext, fwd, ilist, where, sbase, i);
+        fwd->app[i] = reg;
+    }
+    fwd->dirty[i] = true;
+    fwd->used[i] = ++fwd->clock;
+    /* A byte-granularity load can leave bits above the label, which the
+     * store to memory would have dropped.
+     */
+    if (drtaint_shadow_label_size() == 1) {
+#ifdef X86
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_movzx
+                                 (drcontext,
+                                  opnd_create_reg(fwd->holder[i]),
+                                  opnd_create_reg(reg_resize_to_opsz(src, OPSZ_1))));
+#else
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_and
+                                 (drcontext,
+                                  opnd_create_reg(fwd->holder[i]),
+                                  opnd_create_reg(src),
+                                  OPND_CREATE_INT(0xff)));
+#endif
+    } else {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                                 (drcontext,
+                                  opnd_create_reg(fwd->holder[i]),
+                                  opnd_create_reg(src)));
+    }
+}
+
 /* ======================================================================================
  * main implementation, taint propagation step
  * ==================================================================================== */
+enum {
+    MEM_GROUP_NONE,
+    MEM_GROUP_LEADER,
+    MEM_GROUP_MEMBER,
+};
+
+/* An access's part in a group of accesses off the same unmodified base
+ * register, which share the leader's shadow translation. The leader's lo
+ * and hi bound the members' app addresses relative to its own, and each
+ * member sits delta shadow bytes from the leader.
+ */
+typedef struct _mem_group_t {
+    int role;
+    int lo;
+    int hi;
+    int delta;
+} mem_group_t;
+
+#define SHADOW_REGS_ALL ((1u << DR_NUM_GPR_REGS) - 1)
+
+static inline uint
+shadow_reg_mask(reg_id_t reg)
+{
+    if (reg < DR_REG_START_GPR || reg > DR_REG_STOP_GPR)
+        return 0;
+    return 1u << (reg - DR_REG_START_GPR);
+}
+
+static void
+propagate_svc(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+              instr_t *where, reg_id_t sbase)
+{
+    /* svc, or syscall on x86: the kernel overwrites r0 (rax) with the
+     * result. Its shadow is cleared where the syscall returns, see
+     * insert_syscall_return(), so that syscalls writing no memory need not
+     * be intercepted at all.
+     */
+    auto sreg = drreg_reservation { ilist, where };
+
+    drtaint_shadow_insert_syscall_pending(drcontext, ilist, where, sreg);
+}
+
+#ifdef ARM_32
+static void
+insert_app_to_taint_grouped(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            const mem_group_t *group, reg_id_t regaddr,
+                            reg_id_t scratch)
+{
+    switch (group->role) {
+    case MEM_GROUP_LEADER: {
+        auto scratch2 = drreg_reservation { ilist, where };
+        drtaint_shadow_insert_app_to_shadow_leader(drcontext, ilist, where, regaddr,
+                                                   group->lo, group->hi,
+                                                   scratch, scratch2);
+        break;
+    }
+    case MEM_GROUP_MEMBER: {
+        bool dead;
+        /* A member tests the cached translation, which needs the flags.
+         * Saving live flags costs an mrs/msr pair, more than the lookup the
+         * cache saves, so there we translate from scratch.
+         */
+        if (drreg_are_aflags_dead(drcontext, where, &dead) != DRREG_SUCCESS || !dead) {
+            drtaint_profile_count_flags_avoided(drcontext);
+            drtaint_insert_app_to_taint(drcontext, ilist, where, regaddr, scratch);
+            break;
+        }
+        auto flags = drreg_aflags_reservation { ilist, where };
+        drtaint_shadow_insert_app_to_shadow_member(drcontext, ilist, where, regaddr,
+                                                   group->delta, scratch);
+        break;
+    }
+    default:
+        drtaint_insert_app_to_taint(drcontext, ilist, where, regaddr, scratch);
+        break;
+    }
+}
+
+/* ldrd and strd access two words, each the shadow of its own register. We
+ * translate the second word separately as it may be in another shadow block.
+ */
+static void
+insert_second_word_to_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            opnd_t mem, reg_id_t regaddr, reg_id_t scratch)
+{
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem, regaddr, scratch);
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_add
+                             (drcontext,
+                              opnd_create_reg(regaddr),
+                              opnd_create_reg(regaddr),
+                              OPND_CREATE_INT(4)));
+    drtaint_insert_app_to_taint(drcontext, ilist, where, regaddr, scratch);
+}
+
 static void
-propagate_ldr(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_ldr(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+              instr_t *where, reg_id_t sbase, const mem_group_t *group)
 {
     /* ldr reg1, [mem2] */
     auto sreg1 = drreg_reservation { ilist, where };
     auto sapp2 = drreg_reservation { ilist, where };
-    reg_id_t reg1 = opnd_get_reg(instr_get_dst(where, 0));
-    opnd_t   mem2 = instr_get_src(where, 0);
+    reg_id_t reg1 = opnd_get_reg(instr_get_dst(instr, 0));
+    opnd_t   mem2 = instr_get_src(instr, 0);
+    uint     size = opnd_size_in_bytes(opnd_get_size(mem2));
 
     drutil_insert_get_mem_addr(drcontext, ilist, where, mem2, sapp2, sreg1);
-    drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg1);
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg1, sreg1);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_1byte
-                             (drcontext,
-                              opnd_create_reg(sapp2),
-                              OPND_CREATE_MEM8(sapp2, 0)));
-    instrlist_meta_preinsert_xl8(ilist, where, XINST_CREATE_store_1byte
-                                 (drcontext,
-                                  OPND_CREATE_MEM8(sreg1, 0),
-                                  opnd_create_reg(sapp2)));
+    insert_app_to_taint_grouped(drcontext, ilist, where, group, sapp2, sreg1);
+    drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, sreg1,
+                                     size > 4 ? 4 : size);
+    insert_shadow_reg_store(drcontext, ilist, where, reg1, sbase, sreg1);
+    if (size == 8) {
+        /* ldrd reg1, reg1b, [mem2] */
+        reg_id_t reg1b = opnd_get_reg(instr_get_dst(instr, 1));
+        insert_second_word_to_taint(drcontext, ilist, where, mem2, sapp2, sreg1);
+        drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, sreg1, 4);
+        insert_shadow_reg_store(drcontext, ilist, where, reg1b, sbase, sreg1);
+    }
 }
 
 static void
-propagate_str(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_str(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+              instr_t *where, reg_id_t sbase, const mem_group_t *group)
 {
     /* str [mem2], reg1 */
     auto sreg1 = drreg_reservation { ilist, where };
     auto sapp2 = drreg_reservation { ilist, where };
-    reg_id_t reg1 = opnd_get_reg(instr_get_src(where, 0));
-    opnd_t   mem2 = instr_get_dst(where, 0);
+    reg_id_t reg1 = opnd_get_reg(instr_get_src(instr, 0));
+    opnd_t   mem2 = instr_get_dst(instr, 0);
+    uint     size = opnd_size_in_bytes(opnd_get_size(mem2));
 
     drutil_insert_get_mem_addr(drcontext, ilist, where, mem2, sapp2, sreg1);
-    drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg1);
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg1, sreg1);
-    instrlist_meta_preinsert_xl8(ilist, where, XINST_CREATE_store_1byte
-                                 (drcontext,
-                                  OPND_CREATE_MEM8(sapp2, 0),
-                                  opnd_create_reg(sreg1)));
+    insert_app_to_taint_grouped(drcontext, ilist, where, group, sapp2, sreg1);
+    insert_shadow_reg_load(drcontext, ilist, where, reg1, sbase, sreg1);
+    insert_record_origin(drcontext, ilist, where, sbase, sreg1);
+    drtaint_shadow_insert_store_taint(drcontext, ilist, where, instr_get_app_pc(instr),
+                                      sapp2, sreg1, size > 4 ? 4 : size);
+    if (size == 8) {
+        /* strd [mem2], reg1, reg1b */
+        reg_id_t reg1b = opnd_get_reg(instr_get_src(instr, 1));
+        insert_second_word_to_taint(drcontext, ilist, where, mem2, sapp2, sreg1);
+        insert_shadow_reg_load(drcontext, ilist, where, reg1b, sbase, sreg1);
+        insert_record_origin(drcontext, ilist, where, sbase, sreg1);
+        drtaint_shadow_insert_store_taint(drcontext, ilist, where,
+                                          instr_get_app_pc(instr), sapp2, sreg1, 4);
+    }
 }
 
 static void
-propagate_mov_regs(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where,
-                   reg_id_t reg1, reg_id_t reg2)
+propagate_mov_regs(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                   instr_t *where, reg_id_t sbase, reg_id_t reg1, reg_id_t reg2)
 {
     /* mov reg2, reg1 */
-    auto sreg2 = drreg_reservation { ilist, where };
     auto sreg1 = drreg_reservation { ilist, where };
 
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg1, sreg1);
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg2, sreg2);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
-                             (drcontext,
-                              OPND_CREATE_MEM8(sreg2, 0),
-                              opnd_create_reg(sreg1)));
+    insert_shadow_reg_load(drcontext, ilist, where, reg1, sbase, sreg1);
+    insert_shadow_reg_store(drcontext, ilist, where, reg2, sbase, sreg1);
 }
 
 static void
-propagate_mov_reg_src(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_mov_reg_src(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                      instr_t *where, reg_id_t sbase)
 {
     /* mov reg2, reg1 */
-    reg_id_t reg2 = opnd_get_reg(instr_get_dst(where, 0));
-    reg_id_t reg1 = opnd_get_reg(instr_get_src(where, 0));
-    propagate_mov_regs(drcontext, tag, ilist, where, reg1, reg2);
+    reg_id_t reg2 = opnd_get_reg(instr_get_dst(instr, 0));
+    reg_id_t reg1 = opnd_get_reg(instr_get_src(instr, 0));
+    propagate_mov_regs(drcontext, tag, ilist, instr, where, sbase, reg1, reg2);
 }
 
 static void
-propagate_mov_imm_src(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_mov_imm_src(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                      instr_t *where, reg_id_t sbase)
 {
     /* mov reg2, imm1 */
-    auto sreg2 = drreg_reservation { ilist , where };
     auto simm2 = drreg_reservation { ilist , where };
-    reg_id_t reg2 = opnd_get_reg(instr_get_dst(where, 0));
+    reg_id_t reg2 = opnd_get_reg(instr_get_dst(instr, 0));
 
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg2, sreg2);
     instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
                              (drcontext,
                               opnd_create_reg(simm2),
                               opnd_create_immed_int(0, OPSZ_1)));
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
-                             (drcontext,
-                              OPND_CREATE_MEM8(sreg2, 0),
-                              opnd_create_reg(simm2)));
+    insert_shadow_reg_store(drcontext, ilist, where, reg2, sbase, simm2);
 }
 
 static void
-propagate_arith_imm_reg(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_arith_imm_reg(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                        instr_t *where, reg_id_t sbase)
 {
     /* add reg2, imm, reg1 */
-    auto sreg2 = drreg_reservation { ilist, where };
-    auto sreg1 = drreg_reservation { ilist, where };
-    reg_id_t reg2 = opnd_get_reg(instr_get_dst(where, 0));
-    reg_id_t reg1 = opnd_get_reg(instr_get_src(where, 1));
-
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg1, sreg1);
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg2, sreg2);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
-                             (drcontext,
-                              OPND_CREATE_MEM8(sreg2, 0),
-                              opnd_create_reg(sreg1)));
+    reg_id_t reg2 = opnd_get_reg(instr_get_dst(instr, 0));
+    reg_id_t reg1 = opnd_get_reg(instr_get_src(instr, 1));
+    propagate_mov_regs(drcontext, tag, ilist, instr, where, sbase, reg1, reg2);
 }
 
 static void
-propagate_arith_reg_imm(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_arith_reg_imm(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                        instr_t *where, reg_id_t sbase)
 {
     /* add reg2, reg1, imm */
-    auto sreg2 = drreg_reservation { ilist, where };
-    auto sreg1 = drreg_reservation { ilist, where };
-    reg_id_t reg2 = opnd_get_reg(instr_get_dst(where, 0));
-    reg_id_t reg1 = opnd_get_reg(instr_get_src(where, 0));
-
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg1, sreg1);
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg2, sreg2);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
-                             (drcontext,
-                              OPND_CREATE_MEM8(sreg2, 0),
-                              opnd_create_reg(sreg1)));
+    reg_id_t reg2 = opnd_get_reg(instr_get_dst(instr, 0));
+    reg_id_t reg1 = opnd_get_reg(instr_get_src(instr, 0));
+    propagate_mov_regs(drcontext, tag, ilist, instr, where, sbase, reg1, reg2);
 }
 
 static void
-propagate_mla(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_mla(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+              instr_t *where, reg_id_t sbase)
 {
     /* mla reg4, reg3, reg2, reg1 */
     auto sreg1 = drreg_reservation { ilist, where };
     auto sreg2 = drreg_reservation { ilist, where };
-    reg_id_t sreg3 = sreg2;
-    reg_id_t sreg4 = sreg3; /* we reuse a register for this */
+    reg_id_t sreg3 = sreg2; /* we reuse a register for this */
 
-    reg_id_t reg1 = opnd_get_reg(instr_get_src(where, 2));
-    reg_id_t reg2 = opnd_get_reg(instr_get_src(where, 1));
-    reg_id_t reg3 = opnd_get_reg(instr_get_src(where, 0));
-    reg_id_t reg4 = opnd_get_reg(instr_get_dst(where, 0));
+    reg_id_t reg1 = opnd_get_reg(instr_get_src(instr, 2));
+    reg_id_t reg2 = opnd_get_reg(instr_get_src(instr, 1));
+    reg_id_t reg3 = opnd_get_reg(instr_get_src(instr, 0));
+    reg_id_t reg4 = opnd_get_reg(instr_get_dst(instr, 0));
 
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg1, sreg1);
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg2, sreg2);
-    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_orr
-                             (drcontext,
-                              opnd_create_reg(sreg1),
-                              opnd_create_reg(sreg2),
-                              opnd_create_reg(sreg1)));
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg3, sreg3);
-    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_orr
-                             (drcontext,
-                              opnd_create_reg(sreg1),
-                              opnd_create_reg(sreg3),
-                              opnd_create_reg(sreg1)));
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg4, sreg4);
-    instrlist_meta_preinsert_xl8(ilist, where, XINST_CREATE_store_1byte
-                                 (drcontext,
-                                  OPND_CREATE_MEM8(sreg4, 0),
-                                  opnd_create_reg(sreg1)));
+    insert_shadow_reg_load(drcontext, ilist, where, reg1, sbase, sreg1);
+    insert_shadow_reg_load(drcontext, ilist, where, reg2, sbase, sreg2);
+    drtaint_shadow_insert_union(drcontext, ilist, where, sreg1, sreg2);
+    insert_shadow_reg_load(drcontext, ilist, where, reg3, sbase, sreg3);
+    drtaint_shadow_insert_union(drcontext, ilist, where, sreg1, sreg3);
+    insert_shadow_reg_store(drcontext, ilist, where, reg4, sbase, sreg1);
 }
 
 static void
-propagate_umull(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_umull(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                instr_t *where, reg_id_t sbase)
 {
     /* umull reg4, reg3, reg2, reg1 */
     auto sreg1 = drreg_reservation { ilist, where };
     auto sreg2 = drreg_reservation { ilist, where };
-    auto sreg3 = drreg_reservation { ilist, where };
-    reg_id_t sreg4 = sreg3; /* we reuse a register for this */
 
-    reg_id_t reg1 = opnd_get_reg(instr_get_src(where, 0));
-    reg_id_t reg2 = opnd_get_reg(instr_get_src(where, 1));
-    reg_id_t reg3 = opnd_get_reg(instr_get_dst(where, 0));
-    reg_id_t reg4 = opnd_get_reg(instr_get_dst(where, 1));
+    reg_id_t reg1 = opnd_get_reg(instr_get_src(instr, 0));
+    reg_id_t reg2 = opnd_get_reg(instr_get_src(instr, 1));
+    reg_id_t reg3 = opnd_get_reg(instr_get_dst(instr, 0));
+    reg_id_t reg4 = opnd_get_reg(instr_get_dst(instr, 1));
 
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg1, sreg1);
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg2, sreg2);
-    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_orr
-                             (drcontext,
-                              opnd_create_reg(sreg1),
-                              opnd_create_reg(sreg2),
-                              opnd_create_reg(sreg1)));
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg3, sreg3);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
-                             (drcontext,
-                              OPND_CREATE_MEM8(sreg3, 0),
-                              opnd_create_reg(sreg1)));
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg4, sreg4);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
-                             (drcontext,
-                              OPND_CREATE_MEM8(sreg4, 0),
-                              opnd_create_reg(sreg1)));
+    insert_shadow_reg_load(drcontext, ilist, where, reg1, sbase, sreg1);
+    insert_shadow_reg_load(drcontext, ilist, where, reg2, sbase, sreg2);
+    drtaint_shadow_insert_union(drcontext, ilist, where, sreg1, sreg2);
+    insert_shadow_reg_store(drcontext, ilist, where, reg3, sbase, sreg1);
+    insert_shadow_reg_store(drcontext, ilist, where, reg4, sbase, sreg1);
 }
 
 static void
-propagate_arith_reg_reg(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+propagate_arith_reg_reg(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                        instr_t *where, reg_id_t sbase)
 {
     /* add reg3, reg2, reg1 */
     auto sreg2 = drreg_reservation { ilist, where };
     auto sreg1 = drreg_reservation { ilist, where };
-    reg_id_t sreg3 = sreg2; /* we reuse a register for this */
-    reg_id_t reg3 = opnd_get_reg(instr_get_dst(where, 0));
-    reg_id_t reg2 = opnd_get_reg(instr_get_src(where, 0));
-    reg_id_t reg1 = opnd_get_reg(instr_get_src(where, 1));
+    reg_id_t reg3 = opnd_get_reg(instr_get_dst(instr, 0));
+    reg_id_t reg2 = opnd_get_reg(instr_get_src(instr, 0));
+    reg_id_t reg1 = opnd_get_reg(instr_get_src(instr, 1));
 
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg1, sreg1);
-    drtaint_insert_reg_to_taint_load(drcontext, ilist, where, reg2, sreg2);
-    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_orr
-                             (drcontext,
-                              opnd_create_reg(sreg1),
-                              opnd_create_reg(sreg2),
-                              opnd_create_reg(sreg1)));
-    drtaint_insert_reg_to_taint(drcontext, ilist, where, reg3, sreg3);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
-                             (drcontext,
-                              OPND_CREATE_MEM8(sreg3, 0),
-                              opnd_create_reg(sreg1)));
+    insert_shadow_reg_load(drcontext, ilist, where, reg1, sbase, sreg1);
+    insert_shadow_reg_load(drcontext, ilist, where, reg2, sbase, sreg2);
+    drtaint_shadow_insert_union(drcontext, ilist, where, sreg1, sreg2);
+    insert_shadow_reg_store(drcontext, ilist, where, reg3, sbase, sreg1);
 }
 
 static bool
@@ -945,83 +1401,130 @@ instr_is_simd(instr_t *where)
     }
 }
 
+#define TESTANY(mask, var) (((mask) & (var)) != 0)
+
+/* Shadow registers are tracked as a bitmask indexed from DR_REG_START_GPR. */
 typedef enum { DB, IA, DA, IB } stack_dir_t;
 
-template <stack_dir_t T> app_pc
-calculate_addr(instr_t *instr, void *base, int i, int top)
-{ DR_ASSERT_MSG(false, "Unreachable"); }
-template <> app_pc
-calculate_addr<DB>(instr_t *instr, void *base, int i, int top)
-{ return (app_pc)base - 4*(top - i - 1); }
-template <> app_pc
-calculate_addr<IA>(instr_t *instr, void *base, int i, int top)
-{ return (app_pc)base + 4*i; }
-/* XXX: these are probably not correct */
-template <> app_pc
-calculate_addr<DA>(instr_t *instr, void *base, int i, int top)
-{ return (app_pc)base - 4*i; }
-template <> app_pc
-calculate_addr<IB>(instr_t *instr, void *base, int i, int top)
-{ return (app_pc)base + 4*(top - i - 1); }
-
-template <stack_dir_t c> void
-propagate_ldm_cc_template(void *pc, void *base, bool writeback)
+/* Returns the displacement from the base register of the i'th register of an
+ * ldm/stm register list of length top. The lowest numbered register is always
+ * at the lowest address.
+ */
+template <stack_dir_t T> int
+calculate_addr(int i, int top)
+{ DR_ASSERT_MSG(false, "Unreachable"); return 0; }
+template <> int
+calculate_addr<DB>(int i, int top)
+{ return -4*(top - i); }
+template <> int
+calculate_addr<IA>(int i, int top)
+{ return 4*i; }
+template <> int
+calculate_addr<DA>(int i, int top)
+{ return -4*(top - i - 1); }
+template <> int
+calculate_addr<IB>(int i, int top)
+{ return 4*(i + 1); }
+
+static int
+get_reglist(instr_t *instr, bool is_load, reg_id_t base, bool writeback,
+            reg_id_t *regs)
 {
-    void *drcontext = dr_get_current_drcontext();
-    instr_t *instr = instr_create(drcontext);
+    int num = is_load ? instr_num_dsts(instr) : instr_num_srcs(instr);
+    int top = 0;
 
-    decode(drcontext, (byte *)pc, instr);
+    for (int i = 0; i < num; ++i) {
+        opnd_t opnd = is_load ? instr_get_dst(instr, i) : instr_get_src(instr, i);
+        if (!opnd_is_reg(opnd))
+            continue;
+        /* skip the operand describing the base register's writeback */
+        if (writeback && opnd_get_reg(opnd) == base) {
+            writeback = false;
+            continue;
+        }
+        DR_ASSERT(top < DR_NUM_GPR_REGS);
+        regs[top++] = opnd_get_reg(opnd);
+    }
+    return top;
+}
 
-    for (int i = 0; i < instr_num_dsts(instr); ++i) {
-        bool ok;
-        if (writeback &&
-            (opnd_get_reg(instr_get_dst(instr, i)) ==
-             opnd_get_reg(instr_get_src(instr, 1))))
-            break;
-        /* set taint from stack to the appropriate register */
-        byte res;
-        int top = writeback ?
-            instr_num_dsts(instr) :
-            instr_num_dsts(instr) - 1;
-        ok = drtaint_get_app_taint(drcontext, calculate_addr<c>(instr, base, i, top), &res);
-        DR_ASSERT(ok);
-        ok = drtaint_set_reg_taint(drcontext, opnd_get_reg(instr_get_dst(instr, i)), res);
-        DR_ASSERT(ok);
+static void
+insert_add_disp(void *drcontext, instrlist_t *ilist, instr_t *where,
+                reg_id_t dst, reg_id_t src, int disp)
+{
+    if (disp >= 0) {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_add
+                                 (drcontext,
+                                  opnd_create_reg(dst),
+                                  opnd_create_reg(src),
+                                  OPND_CREATE_INT(disp)));
+    } else {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_sub
+                                 (drcontext,
+                                  opnd_create_reg(dst),
+                                  opnd_create_reg(src),
+                                  OPND_CREATE_INT(-disp)));
     }
-    instr_destroy(drcontext, instr);
 }
 
-template <stack_dir_t c> void
-propagate_stm_cc_template(void *pc, void *base, bool writeback)
+template <stack_dir_t c> static void
+propagate_ldm(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+              instr_t *where, reg_id_t sbase, uint live)
 {
-    void *drcontext = dr_get_current_drcontext();
-    instr_t *instr = instr_create(drcontext);
+    /* ldm reg1(!), {reg2, reg3, ...} */
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+    reg_id_t reg1 = opnd_get_base(instr_get_src(instr, 0));
+    bool writeback = instr_num_srcs(instr) > 1;
+    reg_id_t regs[DR_NUM_GPR_REGS];
+    int top = get_reglist(instr, true, reg1, writeback, regs);
 
-    decode(drcontext, (byte *)pc, instr);
+    /* The register list is known statically, so we unroll the copy from
+     * each stack slot's shadow into the shadow of its register.
+     */
+    drreg_get_app_value(drcontext, ilist, where, reg1, sapp1);
+    for (int i = 0; i < top; ++i) {
+        if (!TESTANY(shadow_reg_mask(regs[i]), live))
+            continue;
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1,
+                        calculate_addr<c>(i, top));
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg2);
+        drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, sapp2, 4);
+        insert_shadow_reg_store(drcontext, ilist, where, regs[i], sbase, sapp2);
+    }
+}
 
-    for (int i = 0; i < instr_num_srcs(instr); ++i) {
-        bool ok;
-        if (writeback &&
-            (opnd_get_reg(instr_get_src(instr, i)) ==
-             opnd_get_reg(instr_get_dst(instr, 1))))
-            break;
-        /* set taint from registers to the stack */
-        byte res;
-        ok = drtaint_get_reg_taint(drcontext, opnd_get_reg(instr_get_src(instr, i)), &res);
-        DR_ASSERT(ok);
-        int top = writeback ?
-            instr_num_srcs(instr) :
-            instr_num_srcs(instr) - 1;
-        ok = drtaint_set_app_taint(drcontext, calculate_addr<c>(instr, base, i, top), res);
-        DR_ASSERT(ok);
+template <stack_dir_t c> static void
+propagate_stm(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+              instr_t *where, reg_id_t sbase)
+{
+    /* stm reg1(!), {reg2, reg3, ...} */
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+    reg_id_t reg1 = opnd_get_base(instr_get_dst(instr, 0));
+    bool writeback = instr_num_dsts(instr) > 1;
+    reg_id_t regs[DR_NUM_GPR_REGS];
+    int top = get_reglist(instr, false, reg1, writeback, regs);
+
+    drreg_get_app_value(drcontext, ilist, where, reg1, sapp1);
+    for (int i = 0; i < top; ++i) {
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1,
+                        calculate_addr<c>(i, top));
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg2);
+        insert_shadow_reg_load(drcontext, ilist, where, regs[i], sbase, sreg2);
+        insert_record_origin(drcontext, ilist, where, sbase, sreg2);
+        drtaint_shadow_insert_store_taint(drcontext, ilist, where,
+                                          instr_get_app_pc(instr), sapp2, sreg2, 4);
     }
-    instr_destroy(drcontext, instr);
 }
 
 static bool
-instr_handle_constant_func(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where)
+instr_handle_constant_func(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                           instr_t *where, reg_id_t sbase)
 {
-    short opcode = instr_get_opcode(where);
+    short opcode = instr_get_opcode(instr);
     if (opcode == OP_eor  ||
         opcode == OP_eors ||
         opcode == OP_sub  ||
@@ -1029,129 +1532,1610 @@ instr_handle_constant_func(void *drcontext, void *tag, instrlist_t *ilist, instr
         opcode == OP_sbc  ||
         opcode == OP_sbcs) {
         /* xor r1, r0, r0 */
-        if (!opnd_is_reg(instr_get_src(where, 0)))
+        if (!opnd_is_reg(instr_get_src(instr, 0)))
             return false;
-        if (!opnd_is_reg(instr_get_src(where, 1)))
+        if (!opnd_is_reg(instr_get_src(instr, 1)))
             return false;
-        if (opnd_get_reg(instr_get_src(where, 0)) !=
-            opnd_get_reg(instr_get_src(where, 1)))
+        if (opnd_get_reg(instr_get_src(instr, 0)) !=
+            opnd_get_reg(instr_get_src(instr, 1)))
             return false;
-        propagate_mov_imm_src(drcontext, tag, ilist, where);
+        propagate_mov_imm_src(drcontext, tag, ilist, instr, where, sbase);
         return true;
     }
     return false;
 }
 
-static dr_emit_flags_t
-event_app_instruction(void *drcontext, void *tag, instrlist_t *ilist, instr_t *where,
-                      bool for_trace, bool translating, void *user_data)
-{
-    if (instr_is_simd(where)) {
-        unimplemented_opcode(where);
-        return DR_EMIT_DEFAULT;
-    }
-
-    if (instr_handle_constant_func(drcontext, tag, ilist, where))
-        return DR_EMIT_DEFAULT;
-
-    /* We define a routine to make it easier to call drreg_restore_app_value() in
-     * the case that we have to swap a register out to make space for the stolen
-     * reg.
-     */
-#define DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, opnd, cb)      \
-    do {                                                                \
-        reg_id_t swap = DR_REG_NULL;                                    \
-        drreg_restore_app_values(drcontext, ilist, where, opnd, &swap); \
-        cb;                                                             \
-        if (swap != DR_REG_NULL)                                        \
-            drreg_unreserve_register(drcontext, ilist, where, swap);    \
-    } while (false);
-
-    switch (instr_get_opcode(where)) {
-    case OP_ldmia:
-        DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, instr_get_src(where, 0), {
-            dr_insert_clean_call(drcontext, ilist, where, (void *)propagate_ldm_cc_template<IA>,
-                                 false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(where)),
-                                           opnd_create_reg(opnd_get_base(instr_get_src(where, 0))),
-                                           /* writeback */
-                                           OPND_CREATE_INT8(instr_num_srcs(where) > 1));
-        });
-        break;
-    case OP_ldmdb:
-        DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, instr_get_src(where, 0), {
-            dr_insert_clean_call(drcontext, ilist, where, (void *)propagate_ldm_cc_template<DB>,
-                                 false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(where)),
-                                           opnd_create_reg(opnd_get_base(instr_get_src(where, 0))),
-                                           /* writeback */
-                                           OPND_CREATE_INT8(instr_num_srcs(where) > 1));
-        });
-        break;
-    case OP_ldmib:
-        DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, instr_get_src(where, 0), {
-            dr_insert_clean_call(drcontext, ilist, where, (void *)propagate_ldm_cc_template<IB>,
-                                 false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(where)),
-                                           opnd_create_reg(opnd_get_base(instr_get_src(where, 0))),
-                                           /* writeback */
-                                           OPND_CREATE_INT8(instr_num_srcs(where) > 1));
-        });
-        break;
-    case OP_ldmda:
-        DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, instr_get_src(where, 0), {
-            dr_insert_clean_call(drcontext, ilist, where, (void *)propagate_ldm_cc_template<DA>,
-                                 false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(where)),
-                                           opnd_create_reg(opnd_get_base(instr_get_src(where, 0))),
-                                           /* writeback */
-                                           OPND_CREATE_INT8(instr_num_srcs(where) > 1));
-        });
-        break;
-    case OP_stmia:
-        DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, instr_get_dst(where, 0), {
-            dr_insert_clean_call(drcontext, ilist, where, (void *)propagate_stm_cc_template<IA>,
-                                 false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(where)),
-                                           opnd_create_reg(opnd_get_base(instr_get_dst(where, 0))),
-                                           /* writeback */
-                                           OPND_CREATE_INT8(instr_num_dsts(where) > 1));
-        });
-        break;
-    case OP_stmdb:
-        DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, instr_get_dst(where, 0), {
-            dr_insert_clean_call(drcontext, ilist, where, (void *)propagate_stm_cc_template<DB>,
-                                 false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(where)),
-                                           opnd_create_reg(opnd_get_base(instr_get_dst(where, 0))),
-                                           /* writeback */
-                                           OPND_CREATE_INT8(instr_num_dsts(where) > 1));
-        });
-        break;
-    case OP_stmib:
-        DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, instr_get_dst(where, 0), {
-            dr_insert_clean_call(drcontext, ilist, where, (void *)propagate_stm_cc_template<IB>,
-                                 false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(where)),
-                                           opnd_create_reg(opnd_get_base(instr_get_dst(where, 0))),
-                                           /* writeback */
-                                           OPND_CREATE_INT8(instr_num_dsts(where) > 1));
-        });
-        break;
-    case OP_stmda:
-        DRREG_RESTORE_APP_VALUE(drcontext, ilist, where, instr_get_dst(where, 0), {
-            dr_insert_clean_call(drcontext, ilist, where, (void *)propagate_stm_cc_template<DA>,
-                                 false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(where)),
-                                           opnd_create_reg(opnd_get_base(instr_get_dst(where, 0))),
-                                           /* writeback */
-                                           OPND_CREATE_INT8(instr_num_dsts(where) > 1));
-        });
-        break;
+/* ======================================================================================
+ * SIMD and floating point propagation
+ * ==================================================================================== */
+/* One shadow value of a SIMD instruction's operand: a 32-bit lane of a
+ * SIMD register, or a whole core register.
+ */
+typedef struct _simd_lane_t {
+    reg_id_t gpr; /* DR_REG_NULL for a SIMD lane */
+    uint lane;
+} simd_lane_t;
 
-    case OP_ldr:
-    case OP_ldrb:
-    case OP_ldrd:
-    case OP_ldrh:
-    case OP_ldrsh:
-    case OP_ldrsb:
-    case OP_ldrex:
-        propagate_ldr(drcontext, tag, ilist, where);
-        break;
+/* enough for vldm's 32 single precision registers, twice over */
+#define SIMD_MAX_LANES 64
 
-    case OP_str:
+/* Whether each lane of the destination depends only on the same lane of
+ * the sources that are as wide: elementwise operations on elements of at
+ * most 32 bits, bitwise operations, and moves.
+ */
+static bool
+simd_is_lanewise(instr_t *instr)
+{
+    switch (instr_get_opcode(instr)) {
+    case OP_vaba_s16:
+    case OP_vaba_s32:
+    case OP_vaba_s8:
+    case OP_vaba_u16:
+    case OP_vaba_u32:
+    case OP_vaba_u8:
+    case OP_vabd_s16:
+    case OP_vabd_s32:
+    case OP_vabd_s8:
+    case OP_vabd_u16:
+    case OP_vabd_u32:
+    case OP_vabd_u8:
+    case OP_vabs_f32:
+    case OP_vabs_f64:
+    case OP_vabs_s16:
+    case OP_vabs_s32:
+    case OP_vabs_s8:
+    case OP_vacge_f32:
+    case OP_vacgt_f32:
+    case OP_vadd_f32:
+    case OP_vadd_i16:
+    case OP_vadd_i32:
+    case OP_vadd_i8:
+    case OP_vand:
+    case OP_vbic:
+    case OP_vbif:
+    case OP_vbit:
+    case OP_vbsl:
+    case OP_vceq_f32:
+    case OP_vceq_i16:
+    case OP_vceq_i32:
+    case OP_vceq_i8:
+    case OP_vcge_f32:
+    case OP_vcge_s16:
+    case OP_vcge_s32:
+    case OP_vcge_s8:
+    case OP_vcge_u16:
+    case OP_vcge_u32:
+    case OP_vcge_u8:
+    case OP_vcgt_f32:
+    case OP_vcgt_s16:
+    case OP_vcgt_s32:
+    case OP_vcgt_s8:
+    case OP_vcgt_u16:
+    case OP_vcgt_u32:
+    case OP_vcgt_u8:
+    case OP_vcle_f32:
+    case OP_vcle_s16:
+    case OP_vcle_s32:
+    case OP_vcle_s8:
+    case OP_vcls_s16:
+    case OP_vcls_s32:
+    case OP_vcls_s8:
+    case OP_vclt_f32:
+    case OP_vclt_s16:
+    case OP_vclt_s32:
+    case OP_vclt_s8:
+    case OP_vclz_i16:
+    case OP_vclz_i32:
+    case OP_vclz_i8:
+    case OP_vcnt_8:
+    case OP_vcvt_f32_s32:
+    case OP_vcvt_f32_u32:
+    case OP_vcvt_s32_f32:
+    case OP_vcvt_u32_f32:
+    case OP_vcvta_s32_f32:
+    case OP_vcvta_u32_f32:
+    case OP_vcvtm_s32_f32:
+    case OP_vcvtm_u32_f32:
+    case OP_vcvtn_s32_f32:
+    case OP_vcvtn_u32_f32:
+    case OP_vcvtp_s32_f32:
+    case OP_vcvtp_u32_f32:
+    case OP_vcvtr_s32_f32:
+    case OP_vcvtr_u32_f32:
+    case OP_vdiv_f32:
+    case OP_veor:
+    case OP_vfma_f32:
+    case OP_vfms_f32:
+    case OP_vfnma_f32:
+    case OP_vfnms_f32:
+    case OP_vhadd_s16:
+    case OP_vhadd_s32:
+    case OP_vhadd_s8:
+    case OP_vhadd_u16:
+    case OP_vhadd_u32:
+    case OP_vhadd_u8:
+    case OP_vhsub_s16:
+    case OP_vhsub_s32:
+    case OP_vhsub_s8:
+    case OP_vhsub_u16:
+    case OP_vhsub_u32:
+    case OP_vhsub_u8:
+    case OP_vmax_f32:
+    case OP_vmax_s16:
+    case OP_vmax_s32:
+    case OP_vmax_s8:
+    case OP_vmax_u16:
+    case OP_vmax_u32:
+    case OP_vmax_u8:
+    case OP_vmaxnm_f32:
+    case OP_vmin_f32:
+    case OP_vmin_s16:
+    case OP_vmin_s32:
+    case OP_vmin_s8:
+    case OP_vmin_u16:
+    case OP_vmin_u32:
+    case OP_vmin_u8:
+    case OP_vminnm_f32:
+    case OP_vmla_f32:
+    case OP_vmla_i16:
+    case OP_vmla_i32:
+    case OP_vmla_i8:
+    case OP_vmls_f32:
+    case OP_vmls_i16:
+    case OP_vmls_i32:
+    case OP_vmls_i8:
+    case OP_vmov_f32:
+    case OP_vmov_f64:
+    case OP_vmul_f32:
+    case OP_vmul_i16:
+    case OP_vmul_i32:
+    case OP_vmul_i8:
+    case OP_vmul_p8:
+    case OP_vmvn:
+    case OP_vmvn_i16:
+    case OP_vmvn_i32:
+    case OP_vneg_f32:
+    case OP_vneg_f64:
+    case OP_vneg_s16:
+    case OP_vneg_s32:
+    case OP_vneg_s8:
+    case OP_vnmla_f32:
+    case OP_vnmls_f32:
+    case OP_vnmul_f32:
+    case OP_vorn:
+    case OP_vorr:
+    case OP_vqabs_s16:
+    case OP_vqabs_s32:
+    case OP_vqabs_s8:
+    case OP_vqadd_s16:
+    case OP_vqadd_s32:
+    case OP_vqadd_s8:
+    case OP_vqadd_u16:
+    case OP_vqadd_u32:
+    case OP_vqadd_u8:
+    case OP_vqdmulh_s16:
+    case OP_vqdmulh_s32:
+    case OP_vqneg_s16:
+    case OP_vqneg_s32:
+    case OP_vqneg_s8:
+    case OP_vqrdmulh_s16:
+    case OP_vqrdmulh_s32:
+    case OP_vqrshl_s16:
+    case OP_vqrshl_s32:
+    case OP_vqrshl_s8:
+    case OP_vqrshl_u16:
+    case OP_vqrshl_u32:
+    case OP_vqrshl_u8:
+    case OP_vqshl_s16:
+    case OP_vqshl_s32:
+    case OP_vqshl_s8:
+    case OP_vqshl_u16:
+    case OP_vqshl_u32:
+    case OP_vqshl_u8:
+    case OP_vqshlu_s16:
+    case OP_vqshlu_s32:
+    case OP_vqshlu_s8:
+    case OP_vqsub_s16:
+    case OP_vqsub_s32:
+    case OP_vqsub_s8:
+    case OP_vqsub_u16:
+    case OP_vqsub_u32:
+    case OP_vqsub_u8:
+    case OP_vrecpe_f32:
+    case OP_vrecpe_u32:
+    case OP_vrecps_f32:
+    case OP_vrev16_16:
+    case OP_vrev16_8:
+    case OP_vrev32_16:
+    case OP_vrev32_32:
+    case OP_vrev32_8:
+    case OP_vrhadd_s16:
+    case OP_vrhadd_s32:
+    case OP_vrhadd_s8:
+    case OP_vrhadd_u16:
+    case OP_vrhadd_u32:
+    case OP_vrhadd_u8:
+    case OP_vrinta_f32_f32:
+    case OP_vrintm_f32_f32:
+    case OP_vrintn_f32_f32:
+    case OP_vrintp_f32_f32:
+    case OP_vrintr_f32:
+    case OP_vrintx_f32:
+    case OP_vrintx_f32_f32:
+    case OP_vrintz_f32:
+    case OP_vrintz_f32_f32:
+    case OP_vrshl_s16:
+    case OP_vrshl_s32:
+    case OP_vrshl_s8:
+    case OP_vrshl_u16:
+    case OP_vrshl_u32:
+    case OP_vrshl_u8:
+    case OP_vrshr_s16:
+    case OP_vrshr_s32:
+    case OP_vrshr_s8:
+    case OP_vrshr_u16:
+    case OP_vrshr_u32:
+    case OP_vrshr_u8:
+    case OP_vrsqrte_f32:
+    case OP_vrsqrte_u32:
+    case OP_vrsqrts_f32:
+    case OP_vsel_eq_f32:
+    case OP_vsel_ge_f32:
+    case OP_vsel_gt_f32:
+    case OP_vsel_vs_f32:
+    case OP_vshl_i16:
+    case OP_vshl_i32:
+    case OP_vshl_i8:
+    case OP_vshl_s16:
+    case OP_vshl_s32:
+    case OP_vshl_s8:
+    case OP_vshl_u16:
+    case OP_vshl_u32:
+    case OP_vshl_u8:
+    case OP_vshr_s16:
+    case OP_vshr_s32:
+    case OP_vshr_s8:
+    case OP_vshr_u16:
+    case OP_vshr_u32:
+    case OP_vshr_u8:
+    case OP_vsqrt_f32:
+    case OP_vsub_f32:
+    case OP_vsub_i16:
+    case OP_vsub_i32:
+    case OP_vsub_i8:
+    case OP_vtst_16:
+    case OP_vtst_32:
+    case OP_vtst_8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Whether the destination's old value is an input, as for accumulating
+ * and inserting instructions and those writing a single lane.
+ */
+static bool
+simd_reads_dst(instr_t *instr)
+{
+    switch (instr_get_opcode(instr)) {
+    case OP_vaba_s16:
+    case OP_vaba_s32:
+    case OP_vaba_s8:
+    case OP_vaba_u16:
+    case OP_vaba_u32:
+    case OP_vaba_u8:
+    case OP_vabal_s16:
+    case OP_vabal_s32:
+    case OP_vabal_s8:
+    case OP_vabal_u16:
+    case OP_vabal_u32:
+    case OP_vabal_u8:
+    case OP_vbif:
+    case OP_vbit:
+    case OP_vbsl:
+    case OP_vcvtb_f16_f32:
+    case OP_vcvtb_f16_f64:
+    case OP_vcvtt_f16_f32:
+    case OP_vcvtt_f16_f64:
+    case OP_vfma_f32:
+    case OP_vfma_f64:
+    case OP_vfms_f32:
+    case OP_vfms_f64:
+    case OP_vfnma_f32:
+    case OP_vfnma_f64:
+    case OP_vfnms_f32:
+    case OP_vfnms_f64:
+    case OP_vld1_lane_16:
+    case OP_vld1_lane_32:
+    case OP_vld1_lane_8:
+    case OP_vld2_lane_16:
+    case OP_vld2_lane_32:
+    case OP_vld2_lane_8:
+    case OP_vld3_lane_16:
+    case OP_vld3_lane_32:
+    case OP_vld3_lane_8:
+    case OP_vld4_lane_16:
+    case OP_vld4_lane_32:
+    case OP_vld4_lane_8:
+    case OP_vmla_f32:
+    case OP_vmla_f64:
+    case OP_vmla_i16:
+    case OP_vmla_i32:
+    case OP_vmla_i8:
+    case OP_vmlal_s16:
+    case OP_vmlal_s32:
+    case OP_vmlal_s8:
+    case OP_vmlal_u16:
+    case OP_vmlal_u32:
+    case OP_vmlal_u8:
+    case OP_vmls_f32:
+    case OP_vmls_f64:
+    case OP_vmls_i16:
+    case OP_vmls_i32:
+    case OP_vmls_i8:
+    case OP_vmlsl_s16:
+    case OP_vmlsl_s32:
+    case OP_vmlsl_s8:
+    case OP_vmlsl_u16:
+    case OP_vmlsl_u32:
+    case OP_vmlsl_u8:
+    case OP_vmov_16:
+    case OP_vmov_32:
+    case OP_vmov_8:
+    case OP_vnmla_f32:
+    case OP_vnmla_f64:
+    case OP_vnmls_f32:
+    case OP_vnmls_f64:
+    case OP_vpadal_s16:
+    case OP_vpadal_s32:
+    case OP_vpadal_s8:
+    case OP_vpadal_u16:
+    case OP_vpadal_u32:
+    case OP_vpadal_u8:
+    case OP_vqdmlal_s16:
+    case OP_vqdmlal_s32:
+    case OP_vqdmlsl_s16:
+    case OP_vqdmlsl_s32:
+    case OP_vrsra_s16:
+    case OP_vrsra_s32:
+    case OP_vrsra_s64:
+    case OP_vrsra_s8:
+    case OP_vrsra_u16:
+    case OP_vrsra_u32:
+    case OP_vrsra_u64:
+    case OP_vrsra_u8:
+    case OP_vsli_16:
+    case OP_vsli_32:
+    case OP_vsli_64:
+    case OP_vsli_8:
+    case OP_vsra_s16:
+    case OP_vsra_s32:
+    case OP_vsra_s64:
+    case OP_vsra_s8:
+    case OP_vsra_u16:
+    case OP_vsra_u32:
+    case OP_vsra_u64:
+    case OP_vsra_u8:
+    case OP_vsri_16:
+    case OP_vsri_32:
+    case OP_vsri_64:
+    case OP_vsri_8:
+    case OP_vtbx_8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Appends reg's shadow values to lanes. Core registers are skipped for
+ * instructions accessing memory, where they only form addresses.
+ */
+static int
+simd_reg_lanes(instr_t *instr, reg_id_t reg, simd_lane_t *lanes, int num)
+{
+    uint first, count = drtaint_shadow_simd_lanes(reg, &first);
+
+    for (uint i = 0; i < count && num < SIMD_MAX_LANES; ++i) {
+        lanes[num].gpr = DR_REG_NULL;
+        lanes[num++].lane = first + i;
+    }
+    if (count == 0 && shadow_reg_mask(reg) != 0 && num < SIMD_MAX_LANES &&
+        !instr_reads_memory(instr) && !instr_writes_memory(instr)) {
+        lanes[num].gpr = reg;
+        lanes[num++].lane = 0;
+    }
+    return num;
+}
+
+/* Collects the shadow values of the register sources or destinations in
+ * operand order.
+ */
+static int
+simd_operand_lanes(instr_t *instr, bool dsts, simd_lane_t *lanes)
+{
+    int num_opnds = dsts ? instr_num_dsts(instr) : instr_num_srcs(instr);
+    int num = 0;
+
+    for (int i = 0; i < num_opnds; ++i) {
+        opnd_t opnd = dsts ? instr_get_dst(instr, i) : instr_get_src(instr, i);
+        if (opnd_is_reg(opnd))
+            num = simd_reg_lanes(instr, opnd_get_reg(opnd), lanes, num);
+    }
+    return num;
+}
+
+/* Returns the memory source or destination, or a null operand */
+static opnd_t
+simd_mem_opnd(instr_t *instr, bool dsts)
+{
+    int num_opnds = dsts ? instr_num_dsts(instr) : instr_num_srcs(instr);
+
+    for (int i = 0; i < num_opnds; ++i) {
+        opnd_t opnd = dsts ? instr_get_dst(instr, i) : instr_get_src(instr, i);
+        if (opnd_is_memory_reference(opnd))
+            return opnd;
+    }
+    return opnd_create_null();
+}
+
+/* the words of shadow a SIMD access covers, and the size of each */
+static int
+simd_mem_words(opnd_t mem)
+{
+    uint size = opnd_size_in_bytes(opnd_get_size(mem));
+    return size < 4 ? 1 : size / 4;
+}
+
+static uint
+simd_mem_word_size(opnd_t mem)
+{
+    uint size = opnd_size_in_bytes(opnd_get_size(mem));
+    return size < 4 ? size : 4;
+}
+
+static void
+insert_simd_lane_load(void *drcontext, instrlist_t *ilist, instr_t *where,
+                      const simd_lane_t *lane, reg_id_t sbase, reg_id_t dst)
+{
+    if (lane->gpr != DR_REG_NULL)
+        insert_shadow_reg_load(drcontext, ilist, where, lane->gpr, sbase, dst);
+    else {
+        drtaint_shadow_insert_simd_to_shadow_load_ex(drcontext, ilist, where,
+                                                     lane->lane, sbase, dst);
+    }
+}
+
+static void
+insert_simd_lane_store(void *drcontext, instrlist_t *ilist, instr_t *where,
+                       const simd_lane_t *lane, reg_id_t sbase, reg_id_t src)
+{
+    if (lane->gpr != DR_REG_NULL)
+        insert_shadow_reg_store(drcontext, ilist, where, lane->gpr, sbase, src);
+    else {
+        insert_record_origin(drcontext, ilist, where, sbase, src);
+        drtaint_shadow_insert_simd_to_shadow_store_ex(drcontext, ilist, where,
+                                                      lane->lane, sbase, src);
+    }
+}
+
+/* Unions the shadow of every word mem covers into acc */
+static void
+insert_simd_mem_union(void *drcontext, instrlist_t *ilist, instr_t *where,
+                      opnd_t mem, reg_id_t acc, reg_id_t scratch)
+{
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem, sapp1, scratch);
+    for (int i = 0; i < simd_mem_words(mem); ++i) {
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1, i * 4);
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, scratch);
+        drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, scratch,
+                                         simd_mem_word_size(mem));
+        drtaint_shadow_insert_union(drcontext, ilist, where, acc, scratch);
+    }
+}
+
+/* Writes value, or an empty label if value is DR_REG_NULL, over the
+ * shadow of every word mem covers.
+ */
+static void
+insert_simd_mem_store(void *drcontext, instrlist_t *ilist, instr_t *instr,
+                      instr_t *where, opnd_t mem, reg_id_t sbase, reg_id_t value,
+                      reg_id_t scratch)
+{
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+
+    if (value != DR_REG_NULL)
+        insert_record_origin(drcontext, ilist, where, sbase, value);
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem, sapp1, scratch);
+    for (int i = 0; i < simd_mem_words(mem); ++i) {
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1, i * 4);
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, scratch);
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                                 (drcontext,
+                                  opnd_create_reg(scratch),
+                                  value == DR_REG_NULL ? OPND_CREATE_INT(0) :
+                                  opnd_create_reg(value)));
+        drtaint_shadow_insert_store_taint(drcontext, ilist, where,
+                                          instr_get_app_pc(instr), sapp2, scratch,
+                                          simd_mem_word_size(mem));
+    }
+}
+
+static void
+propagate_simd_load(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                    instr_t *where, reg_id_t sbase, opnd_t mem,
+                    const simd_lane_t *lanes, int num)
+{
+    /* vldm reg1(!), {d2, d3, ...}: the i'th word loaded fills the i'th lane */
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem, sapp1, sreg2);
+    for (int i = 0; i < num; ++i) {
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1, i * 4);
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg2);
+        drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, sapp2, 4);
+        insert_simd_lane_store(drcontext, ilist, where, &lanes[i], sbase, sapp2);
+    }
+}
+
+static void
+propagate_simd_store(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                     instr_t *where, reg_id_t sbase, opnd_t mem,
+                     const simd_lane_t *lanes, int num)
+{
+    /* vstm reg1(!), {d2, d3, ...}: the i'th lane fills the i'th word stored */
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem, sapp1, sreg2);
+    for (int i = 0; i < num; ++i) {
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1, i * 4);
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg2);
+        insert_simd_lane_load(drcontext, ilist, where, &lanes[i], sbase, sreg2);
+        insert_record_origin(drcontext, ilist, where, sbase, sreg2);
+        drtaint_shadow_insert_store_taint(drcontext, ilist, where,
+                                          instr_get_app_pc(instr), sapp2, sreg2, 4);
+    }
+}
+
+static void
+propagate_simd_move(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                    instr_t *where, reg_id_t sbase, const simd_lane_t *srcs,
+                    const simd_lane_t *dsts, int num)
+{
+    /* vmov d1, r2, r3: the sources' shadow values move in order */
+    auto sreg1 = drreg_reservation { ilist, where };
+
+    for (int i = 0; i < num; ++i) {
+        insert_simd_lane_load(drcontext, ilist, where, &srcs[i], sbase, sreg1);
+        insert_simd_lane_store(drcontext, ilist, where, &dsts[i], sbase, sreg1);
+    }
+}
+
+#define SIMD_MAX_WIDE_SRCS 4
+
+static void
+propagate_simd_lanewise(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                        instr_t *where, reg_id_t sbase, const simd_lane_t *dsts, int num)
+{
+    /* vadd.f32 q1, q2, q3: each lane of q1 takes the union of that lane of
+     * every source as wide as q1, and of all of any narrower source, such
+     * as the scalar of a by-scalar multiply.
+     */
+    auto sreg1 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+    auto sreg3 = drreg_reservation { ilist, where };
+    simd_lane_t narrow[SIMD_MAX_LANES];
+    uint wide[SIMD_MAX_WIDE_SRCS + 1];
+    int num_narrow = 0, num_wide = 0;
+    bool has_imm = false;
+
+    /* With an immediate, as a shift amount or a scalar's index, only the
+     * first register source is taken lane by lane.
+     */
+    for (int i = 0; i < instr_num_srcs(instr); ++i) {
+        if (opnd_is_immed(instr_get_src(instr, i)))
+            has_imm = true;
+    }
+    for (int i = 0; i < instr_num_srcs(instr); ++i) {
+        opnd_t src = instr_get_src(instr, i);
+        simd_lane_t lanes[SIMD_MAX_LANES];
+        int count;
+
+        if (!opnd_is_reg(src))
+            continue;
+        count = simd_reg_lanes(instr, opnd_get_reg(src), lanes, 0);
+        if (count == num && lanes[0].gpr == DR_REG_NULL &&
+            num_wide < (has_imm ? 1 : SIMD_MAX_WIDE_SRCS))
+            wide[num_wide++] = lanes[0].lane;
+        else {
+            for (int j = 0; j < count && num_narrow < SIMD_MAX_LANES; ++j)
+                narrow[num_narrow++] = lanes[j];
+        }
+    }
+    if (simd_reads_dst(instr))
+        wide[num_wide++] = dsts[0].lane;
+
+    for (int j = 0; j < num_narrow; ++j) {
+        insert_simd_lane_load(drcontext, ilist, where, &narrow[j], sbase,
+                              j == 0 ? (reg_id_t)sreg3 : (reg_id_t)sreg2);
+        if (j > 0)
+            drtaint_shadow_insert_union(drcontext, ilist, where, sreg3, sreg2);
+    }
+    for (int i = 0; i < num; ++i) {
+        simd_lane_t lane = { DR_REG_NULL, 0 };
+
+        if (num_wide == 0) {
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                                     (drcontext,
+                                      opnd_create_reg(sreg1),
+                                      num_narrow == 0 ? OPND_CREATE_INT(0) :
+                                      opnd_create_reg(sreg3)));
+        } else {
+            for (int k = 0; k < num_wide; ++k) {
+                lane.lane = wide[k] + i;
+                insert_simd_lane_load(drcontext, ilist, where, &lane, sbase,
+                                      k == 0 ? (reg_id_t)sreg1 : (reg_id_t)sreg2);
+                if (k > 0)
+                    drtaint_shadow_insert_union(drcontext, ilist, where, sreg1, sreg2);
+            }
+            if (num_narrow > 0)
+                drtaint_shadow_insert_union(drcontext, ilist, where, sreg1, sreg3);
+        }
+        insert_simd_lane_store(drcontext, ilist, where, &dsts[i], sbase, sreg1);
+    }
+}
+
+static void
+propagate_simd_union(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                     instr_t *where, reg_id_t sbase, const simd_lane_t *srcs,
+                     int num_srcs, opnd_t src_mem, const simd_lane_t *dsts,
+                     int num_dsts, opnd_t dst_mem)
+{
+    /* vld2.16 {d0, d1}, [r0]: every destination takes the union of every
+     * source, and of its own old value where it is only partly written.
+     */
+    auto sreg1 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                             (drcontext,
+                              opnd_create_reg(sreg1),
+                              OPND_CREATE_INT(0)));
+    for (int i = 0; i < num_srcs; ++i) {
+        insert_simd_lane_load(drcontext, ilist, where, &srcs[i], sbase, sreg2);
+        drtaint_shadow_insert_union(drcontext, ilist, where, sreg1, sreg2);
+    }
+    if (simd_reads_dst(instr)) {
+        for (int i = 0; i < num_dsts; ++i) {
+            insert_simd_lane_load(drcontext, ilist, where, &dsts[i], sbase, sreg2);
+            drtaint_shadow_insert_union(drcontext, ilist, where, sreg1, sreg2);
+        }
+    }
+    if (!opnd_is_null(src_mem))
+        insert_simd_mem_union(drcontext, ilist, where, src_mem, sreg1, sreg2);
+    for (int i = 0; i < num_dsts; ++i)
+        insert_simd_lane_store(drcontext, ilist, where, &dsts[i], sbase, sreg1);
+    if (!opnd_is_null(dst_mem))
+        insert_simd_mem_store(drcontext, ilist, instr, where, dst_mem, sbase, sreg1,
+                              sreg2);
+}
+
+static void
+propagate_simd(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+               instr_t *where, reg_id_t sbase)
+{
+    simd_lane_t srcs[SIMD_MAX_LANES], dsts[SIMD_MAX_LANES];
+    opnd_t src_mem = simd_mem_opnd(instr, false);
+    opnd_t dst_mem = simd_mem_opnd(instr, true);
+    int num_srcs = simd_operand_lanes(instr, false, srcs);
+    int num_dsts = simd_operand_lanes(instr, true, dsts);
+
+    switch (instr_get_opcode(instr)) {
+    case OP_vldr:
+    case OP_vldm:
+    case OP_vldmdb:
+    case OP_vld1_8:
+    case OP_vld1_16:
+    case OP_vld1_32:
+    case OP_vld1_64:
+        if (num_dsts == simd_mem_words(src_mem) &&
+            simd_mem_word_size(src_mem) == 4) {
+            propagate_simd_load(drcontext, tag, ilist, instr, where, sbase, src_mem,
+                                dsts, num_dsts);
+            return;
+        }
+        break;
+
+    case OP_vstr:
+    case OP_vstm:
+    case OP_vstmdb:
+    case OP_vst1_8:
+    case OP_vst1_16:
+    case OP_vst1_32:
+    case OP_vst1_64:
+        if (num_srcs == simd_mem_words(dst_mem) &&
+            simd_mem_word_size(dst_mem) == 4) {
+            propagate_simd_store(drcontext, tag, ilist, instr, where, sbase, dst_mem,
+                                 srcs, num_srcs);
+            return;
+        }
+        break;
+
+    case OP_vmov:
+        /* between core and SIMD registers, or two SIMD registers */
+        if (num_srcs == num_dsts) {
+            propagate_simd_move(drcontext, tag, ilist, instr, where, sbase, srcs, dsts,
+                                num_srcs);
+            return;
+        }
+        break;
+
+    case OP_vorr_i16:
+    case OP_vorr_i32:
+    case OP_vbic_i16:
+    case OP_vbic_i32:
+        /* an immediate combined into the destination leaves its taint */
+        return;
+
+    default:
+        if (simd_is_lanewise(instr) && instr_num_dsts(instr) == 1 && num_dsts > 0 &&
+            dsts[0].gpr == DR_REG_NULL) {
+            propagate_simd_lanewise(drcontext, tag, ilist, instr, where, sbase, dsts,
+                                    num_dsts);
+            return;
+        }
+        break;
+    }
+    /* Comparisons and vmsr only write the floating point status register,
+     * whose taint we don't track.
+     */
+    if (num_dsts == 0 && opnd_is_null(dst_mem))
+        return;
+    approximate_simd_opcode(instr);
+    propagate_simd_union(drcontext, tag, ilist, instr, where, sbase, srcs, num_srcs,
+                         src_mem, dsts, num_dsts, dst_mem);
+}
+
+#endif /* ARM_32 */
+
+#ifdef X86_64
+/* ======================================================================================
+ * x86-64 taint propagation
+ * ==================================================================================== */
+/* An x86 instruction gives each destination the union of its value
+ * sources: the registers and memory it reads other than to form
+ * addresses, and lea's address registers. The stack pointer, the flags and
+ * a string instruction's pointers and counter carry no taint, so push and
+ * pop move taint between a register and the stack, and rep movs and stos,
+ * which event_app2app() expands into one iteration at a time, copy it from
+ * [rsi] or from rax to [rdi].
+ *
+ * A write to an 8 or 16-bit register keeps the taint of the rest of the
+ * register, while a 32-bit write zero extends and replaces it. A
+ * predicated instruction, such as cmov, might not write at all, so its
+ * destinations keep their taint too. Memory operands are propagated 4
+ * bytes at a time, each translated on its own as it may be in another
+ * shadow block, up to X86_MAX_MEM_BYTES: the rest of a larger one, such as
+ * xsave's, is left alone.
+ *
+ * Everything here may use the flags, which propagate_instr() holds.
+ */
+#define X86_MAX_MEM_BYTES 32
+
+static dr_emit_flags_t
+event_app2app(void *drcontext, void *tag, instrlist_t *ilist, bool for_trace,
+              bool translating)
+{
+    if (!drutil_expand_rep_string(drcontext, ilist))
+        DR_ASSERT(false);
+    return DR_EMIT_DEFAULT;
+}
+
+static bool
+x86_reg_carries_taint(instr_t *instr, reg_id_t reg)
+{
+    reg_id_t full;
+    uint first;
+
+    if (!reg_is_gpr(reg))
+        return drtaint_shadow_simd_lanes(reg, &first) != 0;
+    full = reg_to_pointer_sized(reg);
+    if (full == DR_REG_XSP)
+        return false;
+    if (instr_is_string_op(instr))
+        return full != DR_REG_XSI && full != DR_REG_XDI && full != DR_REG_XCX;
+    return true;
+}
+
+static bool
+x86_writes_taint(instr_t *instr)
+{
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        opnd_t dst = instr_get_dst(instr, i);
+        if (opnd_is_memory_reference(dst) ||
+            (opnd_is_reg(dst) && x86_reg_carries_taint(instr, opnd_get_reg(dst))))
+            return true;
+    }
+    return false;
+}
+
+/* the bytes of a memory operand that are propagated */
+static uint
+x86_mem_size(opnd_t mem)
+{
+    uint size = opnd_size_in_bytes(opnd_get_size(mem));
+    return size > X86_MAX_MEM_BYTES ? X86_MAX_MEM_BYTES : size;
+}
+
+/* Puts the shadow address of the 4 bytes of mem at offs in regaddr */
+static void
+x86_insert_mem_to_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
+                        opnd_t mem, uint offs, reg_id_t regaddr, reg_id_t scratch)
+{
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem, regaddr, scratch);
+    if (offs != 0) {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lea
+                                 (drcontext,
+                                  opnd_create_reg(regaddr),
+                                  OPND_CREATE_MEM_lea(regaddr, DR_REG_NULL, 0, offs)));
+    }
+    drtaint_insert_app_to_taint(drcontext, ilist, where, regaddr, scratch);
+}
+
+/* Folds scratch into the label accumulated in value. The first source
+ * needs no union, and so no flags.
+ */
+static void
+x86_insert_accumulate(void *drcontext, instrlist_t *ilist, instr_t *where,
+                      reg_id_t value, reg_id_t scratch, bool *empty)
+{
+    if (!*empty) {
+        drtaint_shadow_insert_union(drcontext, ilist, where, value, scratch);
+        return;
+    }
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                             (drcontext,
+                              opnd_create_reg(value),
+                              opnd_create_reg(scratch)));
+    *empty = false;
+}
+
+static void
+x86_insert_reg_union(void *drcontext, instrlist_t *ilist, instr_t *instr,
+                     instr_t *where, reg_id_t reg, reg_id_t sbase, reg_id_t value,
+                     reg_id_t scratch, bool *empty)
+{
+    uint first, num;
+
+    if (reg == DR_REG_NULL || !x86_reg_carries_taint(instr, reg))
+        return;
+    num = drtaint_shadow_simd_lanes(reg, &first);
+    if (num == 0) {
+        insert_shadow_reg_load(drcontext, ilist, where, reg, sbase, scratch);
+        x86_insert_accumulate(drcontext, ilist, where, value, scratch, empty);
+        return;
+    }
+    for (uint i = first; i < first + num; i++) {
+        drtaint_shadow_insert_simd_to_shadow_load_ex(drcontext, ilist, where, i, sbase,
+                                                     scratch);
+        x86_insert_accumulate(drcontext, ilist, where, value, scratch, empty);
+    }
+}
+
+static void
+x86_insert_reg_store(void *drcontext, instrlist_t *ilist, instr_t *instr,
+                     instr_t *where, reg_id_t reg, reg_id_t sbase, reg_id_t value,
+                     reg_id_t scratch)
+{
+    uint first, num;
+    bool keep;
+
+    if (!x86_reg_carries_taint(instr, reg))
+        return;
+    num = drtaint_shadow_simd_lanes(reg, &first);
+    keep = instr_is_predicated(instr) ||
+        (num == 0 && opnd_size_in_bytes(reg_get_size(reg)) < 4);
+    if (num == 0) {
+        if (keep) {
+            insert_shadow_reg_load(drcontext, ilist, where, reg, sbase, scratch);
+            drtaint_shadow_insert_union(drcontext, ilist, where, scratch, value);
+            value = scratch;
+        }
+        insert_shadow_reg_store(drcontext, ilist, where, reg, sbase, value);
+        return;
+    }
+    insert_record_origin(drcontext, ilist, where, sbase, value);
+    for (uint i = first; i < first + num; i++) {
+        reg_id_t lane = value;
+        if (keep) {
+            drtaint_shadow_insert_simd_to_shadow_load_ex(drcontext, ilist, where, i,
+                                                         sbase, scratch);
+            drtaint_shadow_insert_union(drcontext, ilist, where, scratch, value);
+            lane = scratch;
+        }
+        drtaint_shadow_insert_simd_to_shadow_store_ex(drcontext, ilist, where, i, sbase,
+                                                      lane);
+    }
+}
+
+static void
+x86_insert_mem_store(void *drcontext, instrlist_t *ilist, instr_t *instr,
+                     instr_t *where, opnd_t mem, reg_id_t sbase, reg_id_t value,
+                     reg_id_t sapp, reg_id_t scratch)
+{
+    uint size = x86_mem_size(mem);
+
+    insert_record_origin(drcontext, ilist, where, sbase, value);
+    for (uint offs = 0; offs < size; offs += 4) {
+        uint piece = size - offs > 4 ? 4 : size - offs;
+        x86_insert_mem_to_taint(drcontext, ilist, where, mem, offs, sapp, scratch);
+        /* the store spreads the label it is given over the piece */
+        if (instr_is_predicated(instr)) {
+            drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp, scratch,
+                                             piece);
+            drtaint_shadow_insert_union(drcontext, ilist, where, scratch, value);
+        } else {
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                                     (drcontext,
+                                      opnd_create_reg(scratch),
+                                      opnd_create_reg(value)));
+        }
+        drtaint_shadow_insert_store_taint(drcontext, ilist, where,
+                                          instr_get_app_pc(instr), sapp, scratch, piece);
+    }
+}
+
+/* xor eax, eax and the like leave nothing of their sources */
+static bool
+x86_is_zero_idiom(instr_t *instr)
+{
+    switch (instr_get_opcode(instr)) {
+    case OP_xor:
+    case OP_sub:
+    case OP_sbb:
+    case OP_pxor:
+    case OP_xorps:
+    case OP_xorpd:
+    case OP_psubb:
+    case OP_psubw:
+    case OP_psubd:
+    case OP_psubq:
+    case OP_vpxor:
+    case OP_vxorps:
+    case OP_vxorpd:
+        break;
+    default:
+        return false;
+    }
+    return instr_num_srcs(instr) >= 2 &&
+        opnd_is_reg(instr_get_src(instr, 0)) &&
+        opnd_is_reg(instr_get_src(instr, 1)) &&
+        opnd_get_reg(instr_get_src(instr, 0)) == opnd_get_reg(instr_get_src(instr, 1));
+}
+
+/* Whether propagate_x86() writes the flags: for a union of more than one
+ * source, a memory access, a store keeping part of its old label, or an
+ * origin. Plain copies such as mov and movzx between registers don't.
+ */
+static bool
+x86_needs_flags(instr_t *instr, bool sources)
+{
+    uint first, num = 0;
+
+    if (record_origins || instr_is_predicated(instr))
+        return true;
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        opnd_t dst = instr_get_dst(instr, i);
+        if (opnd_is_memory_reference(dst) ||
+            (opnd_is_reg(dst) && reg_is_gpr(opnd_get_reg(dst)) &&
+             opnd_size_in_bytes(reg_get_size(opnd_get_reg(dst))) < 4))
+            return true;
+    }
+    for (int i = 0; sources && i < instr_num_srcs(instr); i++) {
+        opnd_t src = instr_get_src(instr, i);
+        reg_id_t regs[2] = { DR_REG_NULL, DR_REG_NULL };
+        if (opnd_is_reg(src))
+            regs[0] = opnd_get_reg(src);
+        else if (instr_get_opcode(instr) == OP_lea && opnd_is_base_disp(src)) {
+            regs[0] = opnd_get_base(src);
+            regs[1] = opnd_get_index(src);
+        } else if (opnd_is_memory_reference(src))
+            return true;
+        for (int j = 0; j < 2; j++) {
+            if (regs[j] == DR_REG_NULL || !x86_reg_carries_taint(instr, regs[j]))
+                continue;
+            num += reg_is_gpr(regs[j]) ? 1 : drtaint_shadow_simd_lanes(regs[j], &first);
+        }
+    }
+    return num > 1;
+}
+
+static void
+propagate_x86(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+              instr_t *where, reg_id_t sbase, bool sources)
+{
+    auto svalue = drreg_reservation { ilist, where };
+    auto sreg = drreg_reservation { ilist, where };
+    auto sapp = drreg_reservation { ilist, where };
+    bool empty = true;
+
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_int
+                             (drcontext,
+                              opnd_create_reg(svalue),
+                              OPND_CREATE_INT32(0)));
+    for (int i = 0; sources && i < instr_num_srcs(instr); i++) {
+        opnd_t src = instr_get_src(instr, i);
+        if (opnd_is_reg(src)) {
+            x86_insert_reg_union(drcontext, ilist, instr, where, opnd_get_reg(src),
+                                 sbase, svalue, sreg, &empty);
+        } else if (instr_get_opcode(instr) == OP_lea) {
+            if (!opnd_is_base_disp(src))
+                continue;
+            x86_insert_reg_union(drcontext, ilist, instr, where, opnd_get_base(src),
+                                 sbase, svalue, sreg, &empty);
+            x86_insert_reg_union(drcontext, ilist, instr, where, opnd_get_index(src),
+                                 sbase, svalue, sreg, &empty);
+        } else if (opnd_is_memory_reference(src)) {
+            uint size = x86_mem_size(src);
+            for (uint offs = 0; offs < size; offs += 4) {
+                x86_insert_mem_to_taint(drcontext, ilist, where, src, offs, sapp, sreg);
+                drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp, sreg,
+                                                 size - offs > 4 ? 4 : size - offs);
+                x86_insert_accumulate(drcontext, ilist, where, svalue, sreg, &empty);
+            }
+        }
+    }
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        opnd_t dst = instr_get_dst(instr, i);
+        if (opnd_is_reg(dst)) {
+            x86_insert_reg_store(drcontext, ilist, instr, where, opnd_get_reg(dst),
+                                 sbase, svalue, sreg);
+        } else if (opnd_is_memory_reference(dst)) {
+            x86_insert_mem_store(drcontext, ilist, instr, where, dst, sbase, svalue,
+                                 sapp, sreg);
+        }
+    }
+}
+
+static void
+propagate_xchg(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+               instr_t *where, reg_id_t sbase)
+{
+    /* xchg reg1, reg2 */
+    auto sreg1 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+    reg_id_t reg1 = opnd_get_reg(instr_get_dst(instr, 0));
+    reg_id_t reg2 = opnd_get_reg(instr_get_dst(instr, 1));
+
+    insert_shadow_reg_load(drcontext, ilist, where, reg1, sbase, sreg1);
+    insert_shadow_reg_load(drcontext, ilist, where, reg2, sbase, sreg2);
+    insert_shadow_reg_store(drcontext, ilist, where, reg1, sbase, sreg2);
+    insert_shadow_reg_store(drcontext, ilist, where, reg2, sbase, sreg1);
+}
+
+static bool
+instr_is_xchg_regs(instr_t *instr)
+{
+    /* narrower registers keep the rest of their full register's taint */
+    return instr_get_opcode(instr) == OP_xchg &&
+        opnd_is_reg(instr_get_dst(instr, 0)) && opnd_is_reg(instr_get_dst(instr, 1)) &&
+        x86_reg_carries_taint(instr, opnd_get_reg(instr_get_dst(instr, 0))) &&
+        x86_reg_carries_taint(instr, opnd_get_reg(instr_get_dst(instr, 1))) &&
+        opnd_get_size(instr_get_dst(instr, 0)) != OPSZ_1 &&
+        opnd_get_size(instr_get_dst(instr, 0)) != OPSZ_2;
+}
+#endif /* X86_64 */
+
+/* ======================================================================================
+ * basic block analysis, shadow register liveness
+ * ==================================================================================== */
+typedef struct _instr_info_t {
+    /* Shadow registers that may be read after this instruction before they
+     * are overwritten. Every shadow register is live at the block's exit.
+     */
+    uint live_after;
+    mem_group_t group;
+    /* Whether shadow register values may be forwarded in registers here,
+     * and whether the forwarded values are written back after this
+     * instruction's propagation.
+     */
+    bool forward;
+    bool flush_after;
+} instr_info_t;
+
+static const instr_info_t instr_info_default = { SHADOW_REGS_ALL, { MEM_GROUP_NONE },
+                                                 false, false };
+
+typedef struct _bb_info_t {
+    int num_instrs;
+    int cur;
+    instr_info_t *instrs;
+    /* The per_thread_t base, held from the first app instruction to the
+     * last so shadow registers are plain base+offset accesses.
+     */
+    reg_id_t sbase;
+    /* Registers any app instruction in the block reads or writes, and the
+     * scratch registers held over the block in their place.
+     */
+    uint app_regs;
+    /* whether the block stores a SIMD lane's shadow, so its exit rescans them */
+    bool writes_simd;
+    drreg_block_scratch scratch;
+    shadow_fwd_t fwd;
+} bb_info_t;
+
+#ifdef ARM_32
+/* Whether instr may raise a signal. DynamoRIO delays asynchronous signals
+ * to the block's exit, so only memory accesses and traps need be counted.
+ */
+static bool
+instr_may_fault(instr_t *instr)
+{
+    return instr_reads_memory(instr) || instr_writes_memory(instr) ||
+        instr_get_opcode(instr) == OP_udf || instr_get_opcode(instr) == OP_bkpt;
+}
+
+static uint
+instr_shadow_kills(instr_t *instr)
+{
+    reg_id_t regs[DR_NUM_GPR_REGS];
+    uint kills = 0;
+    int top;
+
+    /* Our instrumentation is predicated along with the app instruction, so
+     * a predicated instruction might not overwrite anything.
+     */
+    if (instr_is_predicated(instr) || instr_is_simd(instr))
+        return 0;
+
+    /* This must mirror the shadow registers unconditionally written by the
+     * handlers in propagate_instr().
+     */
+    switch (instr_get_opcode(instr)) {
+    case OP_ldmia:
+    case OP_ldmdb:
+    case OP_ldmib:
+    case OP_ldmda:
+        top = get_reglist(instr, true, opnd_get_base(instr_get_src(instr, 0)),
+                          instr_num_srcs(instr) > 1, regs);
+        for (int i = 0; i < top; ++i)
+            kills |= shadow_reg_mask(regs[i]);
+        return kills;
+
+    case OP_ldr:
+    case OP_ldrb:
+    case OP_ldrh:
+    case OP_ldrsh:
+    case OP_ldrsb:
+    case OP_ldrex:
+    case OP_mov:
+    case OP_mvn:
+    case OP_mvns:
+    case OP_movw:
+    case OP_movt:
+    case OP_movs:
+    case OP_rrx:
+    case OP_rrxs:
+    case OP_sbfx:
+    case OP_ubfx:
+    case OP_uxtb:
+    case OP_uxth:
+    case OP_sxtb:
+    case OP_sxth:
+    case OP_rev:
+    case OP_rev16:
+    case OP_sel:
+    case OP_clz:
+    case OP_adc:
+    case OP_adcs:
+    case OP_add:
+    case OP_adds:
+    case OP_addw:
+    case OP_rsb:
+    case OP_rsbs:
+    case OP_rsc:
+    case OP_sbc:
+    case OP_sbcs:
+    case OP_sub:
+    case OP_subw:
+    case OP_subs:
+    case OP_and:
+    case OP_ands:
+    case OP_bic:
+    case OP_bics:
+    case OP_eor:
+    case OP_eors:
+    case OP_mul:
+    case OP_muls:
+    case OP_orr:
+    case OP_ror:
+    case OP_orrs:
+    case OP_lsl:
+    case OP_lsls:
+    case OP_lsr:
+    case OP_lsrs:
+    case OP_asr:
+    case OP_asrs:
+    case OP_orn:
+    case OP_uadd8:
+    case OP_uqsub8:
+    case OP_mla:
+    case OP_mls:
+        return shadow_reg_mask(opnd_get_reg(instr_get_dst(instr, 0)));
+
+    case OP_ldrd:
+    case OP_smull:
+    case OP_umull:
+        return shadow_reg_mask(opnd_get_reg(instr_get_dst(instr, 0))) |
+               shadow_reg_mask(opnd_get_reg(instr_get_dst(instr, 1)));
+
+    case OP_bl:
+    case OP_blx:
+    case OP_blx_ind:
+        return shadow_reg_mask(DR_REG_LR);
+
+    default:
+        return 0;
+    }
+}
+
+static uint
+instr_shadow_reads(instr_t *instr)
+{
+    uint reads = 0;
+
+    /* Any register the app reads might have its shadow read by our
+     * instrumentation, which is a conservative superset of what the
+     * handlers actually load.
+     */
+    for (int i = 0; i < DR_NUM_GPR_REGS; ++i) {
+        if (instr_reads_from_reg(instr, DR_REG_R0 + i, DR_QUERY_INCLUDE_ALL))
+            reads |= shadow_reg_mask(DR_REG_R0 + i);
+    }
+    return reads;
+}
+
+/* the largest member displacement, in shadow bytes, that an add can encode */
+#define MEM_GROUP_MAX_DELTA 255
+
+static bool
+instr_group_mem(instr_t *instr, opnd_t *mem)
+{
+    switch (instr_get_opcode(instr)) {
+    case OP_ldr:
+    case OP_ldrb:
+    case OP_ldrd:
+    case OP_ldrh:
+    case OP_ldrsh:
+    case OP_ldrsb:
+    case OP_ldrex:
+        *mem = instr_get_src(instr, 0);
+        break;
+    case OP_str:
+    case OP_strb:
+    case OP_strd:
+    case OP_strh:
+    case OP_strex:
+        *mem = instr_get_dst(instr, 0);
+        break;
+    default:
+        return false;
+    }
+    /* A leader that doesn't execute wouldn't set up the translation. */
+    return !instr_is_predicated(instr) &&
+        opnd_is_base_disp(*mem) &&
+        opnd_get_index(*mem) == DR_REG_NULL &&
+        opnd_get_base(*mem) != DR_REG_NULL &&
+        opnd_get_base(*mem) != DR_REG_PC;
+}
+
+static void
+bb_info_find_mem_groups(bb_info_t *bb, instrlist_t *ilist)
+{
+    mem_group_t *leader = NULL;
+    reg_id_t base = DR_REG_NULL;
+    int disp = 0;
+    instr_t *instr;
+    int i = 0;
+
+    /* Accesses join the open group while they use the same base register at
+     * a whole number of shadow bytes from the leader. Only accesses that
+     * propagate_instr will instrument take part.
+     */
+    int scale = drtaint_shadow_scale();
+    int label_size = drtaint_shadow_label_size();
+
+    for (instr = instrlist_first_app(ilist); instr != NULL;
+         instr = instr_get_next_app(instr), ++i) {
+        instr_info_t *info = &bb->instrs[i];
+        uint kills = instr_shadow_kills(instr);
+        opnd_t mem;
+
+        info->group.role = MEM_GROUP_NONE;
+        if (instr_group_mem(instr, &mem) &&
+            (kills == 0 || TESTANY(kills, info->live_after))) {
+            int offs = opnd_get_disp(mem) - disp;
+            int delta = offs / scale * label_size;
+            if (leader != NULL && opnd_get_base(mem) == base && offs % scale == 0 &&
+                delta <= MEM_GROUP_MAX_DELTA && delta >= -MEM_GROUP_MAX_DELTA) {
+                leader->role = MEM_GROUP_LEADER;
+                if (offs < leader->lo)
+                    leader->lo = offs;
+                if (offs > leader->hi)
+                    leader->hi = offs;
+                info->group.role = MEM_GROUP_MEMBER;
+                info->group.delta = delta;
+            } else {
+                leader = &info->group;
+                leader->lo = 0;
+                leader->hi = 0;
+                base = opnd_get_base(mem);
+                disp = opnd_get_disp(mem);
+            }
+        }
+        /* writeback, or any other write, ends the group */
+        if (leader != NULL && instr_writes_to_reg(instr, base, DR_QUERY_INCLUDE_ALL))
+            leader = NULL;
+    }
+}
+#endif
+
+static dr_emit_flags_t
+event_bb_analysis(void *drcontext, void *tag, instrlist_t *ilist, bool for_trace,
+                  bool translating, uintptr_t encoding, void *user_data,
+                  void *orig_analysis_data, void **case_analysis_data)
+{
+    bb_info_t *bb;
+#ifdef ARM_32
+    uint live = SHADOW_REGS_ALL;
+#endif
+    instr_t *instr;
+    int i;
+
+    /* neither the clean copy nor excluded code does register propagation */
+    *case_analysis_data = NULL;
+    if (encoding != DRTAINT_CASE_TAINTED)
+        return DR_EMIT_DEFAULT;
+
+    bb = (bb_info_t *)dr_thread_alloc(drcontext, sizeof(*bb));
+
+    bb->num_instrs = 0;
+    bb->cur = 0;
+    bb->sbase = DR_REG_NULL;
+    bb->app_regs = 0;
+    bb->writes_simd = false;
+    for (instr = instrlist_first_app(ilist); instr != NULL;
+         instr = instr_get_next_app(instr)) {
+        bb->num_instrs++;
+        for (i = 0; i < instr_num_dsts(instr); i++) {
+            uint first;
+            if (opnd_is_reg(instr_get_dst(instr, i)) &&
+                drtaint_shadow_simd_lanes(opnd_get_reg(instr_get_dst(instr, i)),
+                                          &first) != 0)
+                bb->writes_simd = true;
+        }
+#ifdef ARM_32
+        for (reg_id_t reg = DR_REG_R0; reg <= DR_REG_LR; reg++) {
+            if (instr_uses_reg(instr, reg))
+                bb->app_regs |= shadow_reg_mask(reg);
+        }
+#endif
+    }
+    bb->instrs = (instr_info_t *)
+        dr_thread_alloc(drcontext, sizeof(instr_info_t) * bb->num_instrs);
+#ifdef X86_64
+    /* x86 propagation tracks no liveness, and neither forwards nor groups */
+    for (i = 0; i < bb->num_instrs; i++)
+        bb->instrs[i] = instr_info_default;
+#else
+    /* Walk backwards from the block's exit. We don't treat faulting
+     * instructions as reads, so a signal handler interrupting the block may
+     * see a stale shadow value in a register whose write was dropped. The
+     * write was only dropped because a later instruction overwrites the
+     * register, and resuming the block runs that instruction, so the stale
+     * value never outlives the handler. Forwarding, which could lose a
+     * value for good, ends its runs at every instruction that may fault.
+     *
+     * A trace is analysed as a whole, so shadow writes that a later block
+     * of the trace overwrites are dropped, and memory groups and the
+     * shadow base carry across its blocks. Every shadow register is live
+     * where a branch may leave the trace.
+     */
+    i = bb->num_instrs;
+    for (instr = instrlist_last_app(ilist); instr != NULL;
+         instr = instr_get_prev_app(instr)) {
+        --i;
+        bb->instrs[i].live_after = live;
+        bb->instrs[i].forward = !instr_is_predicated(instr) && !instr_is_cti(instr) &&
+            !instr_is_syscall(instr) && !instr_is_simd(instr) && !instr_may_fault(instr);
+        bb->instrs[i].flush_after = bb->instrs[i].forward &&
+            (i + 1 == bb->num_instrs || !bb->instrs[i + 1].forward);
+        live = (live & ~instr_shadow_kills(instr)) | instr_shadow_reads(instr);
+        if (for_trace && instr_is_cti(instr))
+            live = SHADOW_REGS_ALL;
+    }
+    bb_info_find_mem_groups(bb, ilist);
+#endif
+    *case_analysis_data = bb;
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+event_bb_analysis_free(void *drcontext, uintptr_t encoding, void *user_data,
+                       void *orig_analysis_data, void *case_analysis_data)
+{
+    bb_info_t *bb = (bb_info_t *)case_analysis_data;
+
+    if (bb == NULL)
+        return;
+    dr_thread_free(drcontext, bb->instrs, sizeof(instr_info_t) * bb->num_instrs);
+    dr_thread_free(drcontext, bb, sizeof(*bb));
+}
+
+static const instr_info_t *
+bb_info_next(bb_info_t *bb, instr_t *instr)
+{
+    /* We are handed each case's app instructions in order. */
+    if (!instr_is_app(instr) || bb->cur >= bb->num_instrs)
+        return &instr_info_default;
+    return &bb->instrs[bb->cur++];
+}
+
+static void
+bb_info_reserve_base(void *drcontext, bb_info_t *bb, instrlist_t *ilist, instr_t *where)
+{
+    instr_t *mark = drtaint_profile_mark(ilist, where);
+
+    if (drreg_reserve_register(drcontext, ilist, where, NULL, &bb->sbase) !=
+        DRREG_SUCCESS)
+        DR_ASSERT(false);
+    drtaint_profile_count_spills(drcontext, ilist, mark, where);
+    drtaint_shadow_insert_reg_base(drcontext, ilist, where, bb->sbase);
+
+    /* Forward only when propagation is left enough scratch registers of
+     * its own. x86 propagation uses the flags, which a block scope rules
+     * out, so it takes no block scratch and forwards nothing.
+     */
+    shadow_fwd_t *fwd = &bb->fwd;
+    memset(fwd, 0, sizeof(*fwd));
+    fwd->sbase = bb->sbase;
+#ifdef ARM_32
+    bb->scratch.acquire(drcontext, ilist, where, bb->app_regs);
+    if (!no_forwarding && bb->scratch.available() >= FWD_NUM_HOLDERS + 3) {
+        for (int i = 0; i < FWD_NUM_HOLDERS; i++) {
+            bb->scratch.take(&fwd->holder[i]);
+            fwd->app[i] = DR_REG_NULL;
+        }
+        fwd->num_holders = FWD_NUM_HOLDERS;
+    }
+#endif
+    drmgr_set_tls_field(drcontext, fwd_tls, fwd);
+}
+
+static void
+bb_info_unreserve_base(void *drcontext, bb_info_t *bb, instrlist_t *ilist,
+                       instr_t *where)
+{
+    shadow_fwd_t *fwd = &bb->fwd;
+    instr_t *mark;
+
+    drmgr_set_tls_field(drcontext, fwd_tls, NULL);
+#ifdef ARM_32
+    for (int i = 0; i < fwd->num_holders; i++)
+        bb->scratch.give(fwd->holder[i]);
+    fwd->num_holders = 0;
+    bb->scratch.release(drcontext, ilist, where);
+#endif
+    mark = drtaint_profile_mark(ilist, where);
+    if (drreg_unreserve_register(drcontext, ilist, where, bb->sbase) != DRREG_SUCCESS)
+        DR_ASSERT(false);
+    drtaint_profile_count_spills(drcontext, ilist, mark, where);
+    bb->sbase = DR_REG_NULL;
+}
+
+/* ======================================================================================
+ * instruction dispatch
+ * ==================================================================================== */
+#ifdef X86_64
+static void
+propagate_instr(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                instr_t *where, reg_id_t sbase, const instr_info_t *info)
+{
+    if (instr_is_syscall(instr)) {
+        propagate_svc(drcontext, tag, ilist, instr, where, sbase);
+        return;
+    }
+    if (!x86_writes_taint(instr))
+        return;
+    /* a branch's target and a zero idiom's sources say nothing of the
+     * values written
+     */
+    bool sources = !instr_is_cti(instr) && !x86_is_zero_idiom(instr);
+    bool xchg = instr_is_xchg_regs(instr);
+    bool dead;
+
+    /* a swap only moves labels */
+    if (xchg ? record_origins : x86_needs_flags(instr, sources)) {
+        auto flags = drreg_aflags_reservation { ilist, where };
+        if (xchg)
+            propagate_xchg(drcontext, tag, ilist, instr, where, sbase);
+        else
+            propagate_x86(drcontext, tag, ilist, instr, where, sbase, sources);
+        return;
+    }
+    if (drreg_are_aflags_dead(drcontext, where, &dead) != DRREG_SUCCESS || !dead)
+        drtaint_profile_count_flags_avoided(drcontext);
+    if (xchg)
+        propagate_xchg(drcontext, tag, ilist, instr, where, sbase);
+    else
+        propagate_x86(drcontext, tag, ilist, instr, where, sbase, sources);
+}
+#else
+static void
+propagate_instr(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                instr_t *where, reg_id_t sbase, const instr_info_t *info)
+{
+    uint live = info->live_after;
+    uint kills;
+
+    if (instr_is_simd(instr)) {
+        propagate_simd(drcontext, tag, ilist, instr, where, sbase);
+        return;
+    }
+
+    /* skip instructions whose shadow writes are all overwritten before use */
+    kills = instr_shadow_kills(instr);
+    if (kills != 0 && !TESTANY(kills, live))
+        return;
+
+    if (instr_handle_constant_func(drcontext, tag, ilist, instr, where, sbase))
+        return;
+
+    switch (instr_get_opcode(instr)) {
+    case OP_ldmia:
+        propagate_ldm<IA>(drcontext, tag, ilist, instr, where, sbase, live);
+        break;
+    case OP_ldmdb:
+        propagate_ldm<DB>(drcontext, tag, ilist, instr, where, sbase, live);
+        break;
+    case OP_ldmib:
+        propagate_ldm<IB>(drcontext, tag, ilist, instr, where, sbase, live);
+        break;
+    case OP_ldmda:
+        propagate_ldm<DA>(drcontext, tag, ilist, instr, where, sbase, live);
+        break;
+    case OP_stmia:
+        propagate_stm<IA>(drcontext, tag, ilist, instr, where, sbase);
+        break;
+    case OP_stmdb:
+        propagate_stm<DB>(drcontext, tag, ilist, instr, where, sbase);
+        break;
+    case OP_stmib:
+        propagate_stm<IB>(drcontext, tag, ilist, instr, where, sbase);
+        break;
+    case OP_stmda:
+        propagate_stm<DA>(drcontext, tag, ilist, instr, where, sbase);
+        break;
+
+    case OP_ldr:
+    case OP_ldrb:
+    case OP_ldrd:
+    case OP_ldrh:
+    case OP_ldrsh:
+    case OP_ldrsb:
+    case OP_ldrex:
+        propagate_ldr(drcontext, tag, ilist, instr, where, sbase, &info->group);
+        break;
+
+    case OP_str:
     case OP_strb:
     case OP_strd:
     case OP_strh:
@@ -1159,167 +3143,919 @@ event_app_instruction(void *drcontext, void *tag, instrlist_t *ilist, instr_t *w
         /* For OP_strex, failure is written to a second dst operand,
          * but this isn't controllable.
          */
-        propagate_str(drcontext, tag, ilist, where);
+        propagate_str(drcontext, tag, ilist, instr, where, sbase, &info->group);
+        break;
+
+    case OP_mov:
+    case OP_mvn:
+    case OP_mvns:
+    case OP_movw:
+    case OP_movt:
+    case OP_movs:
+    case OP_rrx:
+    case OP_rrxs:
+        if (opnd_is_reg(instr_get_src(instr, 0)))
+            propagate_mov_reg_src(drcontext, tag, ilist, instr, where, sbase);
+        else
+            propagate_mov_imm_src(drcontext, tag, ilist, instr, where, sbase);
+        break;
+
+    case OP_sbfx:
+    case OP_ubfx:
+    case OP_uxtb:
+    case OP_uxth:
+    case OP_sxtb:
+    case OP_sxth:
+    case OP_rev:
+    case OP_rev16:
+        /* These aren't mov's per se, but they only accept 1
+         * reg source and 1 reg dest.
+         */
+        propagate_mov_reg_src(drcontext, tag, ilist, instr, where, sbase);
+        break;
+
+    case OP_sel:
+    case OP_clz:
+        /* These aren't mov's per se, but they only accept 1
+         * reg source and 1 dest.
+         */
+        if (opnd_is_reg(instr_get_src(instr, 0)))
+            propagate_mov_reg_src(drcontext, tag, ilist, instr, where, sbase);
+        else
+            propagate_mov_imm_src(drcontext, tag, ilist, instr, where, sbase);
+        break;
+
+    case OP_adc:
+    case OP_adcs:
+    case OP_add:
+    case OP_adds:
+    case OP_addw:
+    case OP_rsb:
+    case OP_rsbs:
+    case OP_rsc:
+    case OP_sbc:
+    case OP_sbcs:
+    case OP_sub:
+    case OP_subw:
+    case OP_subs:
+    case OP_and:
+    case OP_ands:
+    case OP_bic:
+    case OP_bics:
+    case OP_eor:
+    case OP_eors:
+    case OP_mul:
+    case OP_muls:
+    case OP_orr:
+    case OP_ror:
+    case OP_orrs:
+    case OP_lsl:
+    case OP_lsls:
+    case OP_lsr:
+    case OP_lsrs:
+    case OP_asr:
+    case OP_asrs:
+    case OP_orn:
+    case OP_uadd8:
+    case OP_uqsub8:
+        /* Some of these also write to eflags. If we taint eflags
+         * we should do it here.
+         */
+        DR_ASSERT(instr_num_srcs(instr) == 2 || instr_num_srcs(instr) == 4);
+        DR_ASSERT(instr_num_dsts(instr) == 1);
+        if (opnd_is_reg(instr_get_src(instr, 0))) {
+            if (opnd_is_reg(instr_get_src(instr, 1)))
+                propagate_arith_reg_reg(drcontext, tag, ilist, instr, where, sbase);
+            else
+                propagate_arith_reg_imm(drcontext, tag, ilist, instr, where, sbase);
+        } else if (opnd_is_reg(instr_get_src(instr, 1)))
+            propagate_arith_imm_reg(drcontext, tag, ilist, instr, where, sbase);
+        else
+            DR_ASSERT(false); /* add reg, imm, imm does not make sense */
+        break;
+
+    case OP_smull:
+    case OP_umull:
+        propagate_umull(drcontext, tag, ilist, instr, where, sbase);
+        break;
+
+    case OP_mla:
+    case OP_mls:
+        propagate_mla(drcontext, tag, ilist, instr, where, sbase);
+        break;
+
+    case OP_bl:
+    case OP_blx:
+    case OP_blx_ind:
+        propagate_mov_regs(drcontext, tag, ilist, instr, where, sbase,
+                           DR_REG_PC, DR_REG_LR);
+        /* fallthrough, we could have a register dest */
+    case OP_bxj:
+    case OP_bx:
+    case OP_b:
+    case OP_b_short:
+        /* could have register destination */
+        if (opnd_is_reg(instr_get_src(instr, 0))) {
+            propagate_mov_regs(drcontext, tag, ilist, instr, where, sbase,
+                               opnd_get_reg(instr_get_src(instr, 0)),
+                               DR_REG_PC);
+        }
+        /* we don't have to do anything for immediates */
+        break;
+
+    case OP_cbz:
+    case OP_cbnz:
+        /* Nothing to do here, unless we want to support tainting
+         * eflags.
+         */
+        break;
+    case OP_cmn:
+    case OP_cmp:
+    case OP_tst:
+    case OP_it:
+        /* Nothing to do here, unless we want to support tainting
+         * eflags.
+         */
+        break;
+
+    case OP_svc:
+        propagate_svc(drcontext, tag, ilist, instr, where, sbase);
+        break;
+
+    case OP_LABEL:
+    case OP_ldc:
+    case OP_mcr:
+    case OP_mrc:
+    case OP_nop:
+    case OP_pld:
+    case OP_dmb:
+        break;
+
+    case OP_bfi:
+    case OP_bfc:
+    case OP_teq:
+        break;
+
+    default:
+        unimplemented_opcode(instr);
         break;
+    }
+}
+#endif
+
+/* ======================================================================================
+ * clean-state fast path
+ * ==================================================================================== */
+#ifdef ARM_32
+static bool
+instr_reads_pc_value(instr_t *instr)
+{
+    for (int i = 0; i < instr_num_srcs(instr); ++i) {
+        opnd_t src = instr_get_src(instr, i);
+        if (opnd_is_reg(src) && opnd_get_reg(src) == DR_REG_PC)
+            return true;
+    }
+    return false;
+}
+#endif
+
+static void
+event_bb_orig_analysis(void *drcontext, void *tag, instrlist_t *ilist, void *user_data,
+                       void **orig_analysis_data)
+{
+    /* the stats counters are shared by both copies and owned by the stats */
+    *orig_analysis_data = drtaint_stats_enabled() ?
+        drtaint_stats_block(tag, ilist) : NULL;
+}
+
+/* Whether instr may be where execution resumes after an svc, or x86's
+ * syscall. A syscall ends its block, so that is normally the first
+ * instruction of a block, and we look for a syscall encoding just before
+ * it in memory. A false match only costs the check in
+ * insert_syscall_return(), which does nothing unless a syscall is pending.
+ */
+static bool
+instr_follows_svc(void *drcontext, instr_t *instr)
+{
+    app_pc pc = instr_get_app_pc(instr);
+    bool first;
+    ushort half;
+
+    if (drbbdup_is_first_instr(drcontext, instr, &first) != DRBBDUP_SUCCESS || !first)
+        return instr_get_prev_app(instr) != NULL &&
+            instr_is_syscall(instr_get_prev_app(instr));
+#ifdef X86_64
+    /* syscall is 0f 05 */
+    return dr_safe_read(pc - 2, sizeof(half), &half, NULL) && half == 0x050f;
+#else
+    uint word;
+
+    if (instr_get_isa_mode(instr) == DR_ISA_ARM_THUMB) {
+        /* T1 svc is 0xdfXX, and T32 has no other svc */
+        return dr_safe_read(pc - 2, sizeof(half), &half, NULL) &&
+            (half & 0xff00) == 0xdf00;
+    }
+    /* A1 svc is cond:1111:imm24 */
+    return dr_safe_read(pc - 4, sizeof(word), &word, NULL) &&
+        (word & 0x0f000000) == 0x0f000000;
+#endif
+}
+
+/* Clears r0's shadow at the return from a syscall made without
+ * interception, if it hasn't been cleared yet. sbase is the per_thread_t
+ * base, or DR_REG_NULL in the clean copy, where r0 is already clean and
+ * only the pending mark is cleared.
+ */
+static void
+insert_syscall_return(void *drcontext, instrlist_t *ilist, instr_t *where,
+                      reg_id_t sbase)
+{
+    auto sreg1 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+#ifdef X86_64
+    auto flags = drreg_aflags_reservation { ilist, where };
+#endif
+
+    drtaint_shadow_insert_syscall_return(drcontext, ilist, where, sbase, sreg1, sreg2);
+}
+
+/* The lengths of the call instructions instr_follows_call() looks for */
+#ifdef X86_64
+# define CALL_MIN_LENGTH 2
+# define CALL_MAX_LENGTH 8
+# define CALL_LENGTH_STEP 1
+#else
+# define CALL_MIN_LENGTH 2
+# define CALL_MAX_LENGTH 4
+# define CALL_LENGTH_STEP 2
+#endif
+
+/* Whether instr may be a return site: the first instruction of a block,
+ * just after a call in memory. Like instr_follows_svc(), a false match only
+ * costs the check in insert_excluded_return().
+ */
+static bool
+instr_follows_call(void *drcontext, instr_t *instr)
+{
+    app_pc pc = instr_get_app_pc(instr);
+    byte buf[CALL_MAX_LENGTH];
+    uint min = CALL_MIN_LENGTH;
+    bool first, found = false;
+    instr_t call;
+
+    if (drbbdup_is_first_instr(drcontext, instr, &first) != DRBBDUP_SUCCESS || !first)
+        return false;
+#ifdef ARM_32
+    if (instr_get_isa_mode(instr) != DR_ISA_ARM_THUMB)
+        min = 4;
+#endif
+    instr_init(drcontext, &call);
+    for (uint len = min; len <= CALL_MAX_LENGTH && !found; len += CALL_LENGTH_STEP) {
+        if (!dr_safe_read(pc - len, len, buf, NULL))
+            break;
+        instr_reset(drcontext, &call);
+        found = decode_from_copy(drcontext, buf, pc - len, &call) == buf + len &&
+            instr_is_call(&call);
+    }
+    instr_free(drcontext, &call);
+    return found;
+}
+
+/* Whether register taint is cleared where excluded code returns */
+static bool
+clears_excluded_returns(void)
+{
+    return excluded_policy == DRTAINT_EXCLUDED_CLEAR && drtaint_filter_enabled();
+}
+
+/* Marks instr, the exit of an excluded block, as returning, or unmarks it
+ * if it calls or jumps somewhere that may be included, see
+ * drtaint_shadow_insert_excluded_exit().
+ */
+static void
+insert_excluded_exit(void *drcontext, instrlist_t *ilist, instr_t *instr,
+                     instr_t *where)
+{
+    bool returning = instr_is_return(instr);
+
+    if (!instr_is_cti(instr))
+        return;
+    if (!returning && !instr_is_call(instr) && !instr_is_mbr(instr) &&
+        !drtaint_filter_includes(opnd_get_pc(instr_get_target(instr))) &&
+        !(instr_is_cbr(instr) &&
+          drtaint_filter_includes(instr_get_app_pc(instr) +
+                                  instr_length(drcontext, instr))))
+        return;
+    auto sreg = drreg_reservation { ilist, where };
+    drtaint_shadow_insert_excluded_exit(drcontext, ilist, where, returning, sreg);
+}
+
+/* Recomputes the register summary at the exit of an instrumented block,
+ * after its last propagation. The summary was set on entry, so it is never
+ * stale zero should the block be left before it reaches its exit.
+ */
+static void
+insert_reg_summary(void *drcontext, instrlist_t *ilist, instr_t *where, bb_info_t *bb)
+{
+    auto sreg1 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+#ifdef X86_64
+    auto flags = drreg_aflags_reservation { ilist, where };
+#endif
+
+    drtaint_shadow_insert_reg_summary(drcontext, ilist, where, bb->sbase, sreg1, sreg2,
+                                      bb->writes_simd);
+}
+
+/* Clears the shadow of the caller-saved registers at a return site if
+ * excluded code just returned to it. In the clean copy no register is
+ * tainted, so only the mark is cleared. This runs before the block scope
+ * is set up, as it branches on the flags.
+ */
+static void
+insert_excluded_return(void *drcontext, instrlist_t *ilist, instr_t *where, bool clean)
+{
+    auto sreg = drreg_reservation { ilist, where };
+
+    if (clean) {
+        drtaint_shadow_insert_excluded_return(drcontext, ilist, where, DR_REG_NULL,
+                                              sreg);
+        return;
+    }
+    auto sbase = drreg_reservation { ilist, where };
+    auto flags = drreg_aflags_reservation { ilist, where };
+    drtaint_shadow_insert_reg_base(drcontext, ilist, where, sbase);
+    drtaint_shadow_insert_excluded_return(drcontext, ilist, where, sbase, sreg);
+}
+
+/* Whether every block of a block or trace is in excluded code. A trace
+ * that also runs included code is propagated through as a whole.
+ */
+static bool
+instrlist_is_excluded(instrlist_t *ilist)
+{
+    instr_t *instr, *prev = NULL;
+
+    for (instr = instrlist_first_app(ilist); instr != NULL;
+         prev = instr, instr = instr_get_next_app(instr)) {
+        if ((prev == NULL || instr_is_cti(prev)) &&
+            drtaint_filter_includes(instr_get_app_pc(instr)))
+            return false;
+    }
+    return true;
+}
+
+static uintptr_t
+event_bb_setup(void *drbbdup_ctx, void *drcontext, void *tag, instrlist_t *ilist,
+               bool *enable_dups, bool *enable_dynamic_handling, void *user_data)
+{
+    /* This is the one place a block is decided to be excluded: every later
+     * event sees it in the default case's encoding.
+     */
+    *enable_dynamic_handling = false;
+    if (instrlist_is_excluded(ilist)) {
+        *enable_dups = false;
+        return DRTAINT_CASE_EXCLUDED;
+    }
+
+    instr_t *instr;
+
+    /* The clean copy assumes that no shadow register changes for the whole
+     * block. Clients set pc's shadow right before it is read, and the check
+     * on a predicated ARM load would have to branch under a predicate, so
+     * we don't duplicate blocks with either. x86 meta instructions aren't
+     * predicated, so there a predicated store's clear would be
+     * unconditional.
+     */
+    *enable_dups = true;
+    for (instr = instrlist_first_app(ilist); instr != NULL;
+         instr = instr_get_next_app(instr)) {
+#ifdef X86_64
+        if (instr_is_predicated(instr) && instr_writes_memory(instr)) {
+#else
+        if (instr_reads_pc_value(instr) ||
+            (instr_is_predicated(instr) && instr_reads_memory(instr))) {
+#endif
+            *enable_dups = false;
+            break;
+        }
+    }
+    if (*enable_dups &&
+        drbbdup_register_case_encoding(drbbdup_ctx, DRTAINT_CASE_CLEAN) !=
+        DRBBDUP_SUCCESS)
+        *enable_dups = false;
+    return DRTAINT_CASE_TAINTED;
+}
+
+static void
+switch_to_tainted_case(app_pc pc)
+{
+    void *drcontext = dr_get_current_drcontext();
+    dr_mcontext_t mc = { sizeof(mc), DR_MC_ALL };
+
+    /* Re-execute from the load with the summary forced on, which selects the
+     * instrumented copy of the block starting there.
+     */
+    drtaint_stats_callout(DRTAINT_STATS_CALLOUT_BAIL);
+    drtaint_shadow_force_reg_summary(drcontext);
+    dr_get_mcontext(drcontext, &mc);
+    mc.pc = dr_app_pc_as_jump_target(dr_get_isa_mode(drcontext), pc);
+    dr_redirect_execution(&mc);
+}
+
+static void
+insert_bail_if_tainted(void *drcontext, instrlist_t *ilist, instr_t *where,
+                       reg_id_t shadow, instr_t *bail)
+{
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_cmp
+                             (drcontext,
+                              opnd_create_reg(shadow),
+                              OPND_CREATE_INT32(0)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump_cond
+                             (drcontext, IF_X86_ELSE(DR_PRED_NZ, DR_PRED_NE),
+                              opnd_create_instr(bail)));
+}
+
+static void
+insert_bail(void *drcontext, instrlist_t *ilist, instr_t *instr, instr_t *where,
+            instr_t *bail)
+{
+    instr_t *done = INSTR_CREATE_label(drcontext);
+
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump
+                             (drcontext, opnd_create_instr(done)));
+    instrlist_meta_preinsert(ilist, where, bail);
+    dr_insert_clean_call_ex(drcontext, ilist, where, (void *)switch_to_tainted_case,
+                            (dr_cleancall_save_t)(DR_CLEANCALL_READS_APP_CONTEXT |
+                                                  DR_CLEANCALL_MULTIPATH),
+                            1, OPND_CREATE_INTPTR(instr_get_app_pc(instr)));
+    instrlist_meta_preinsert(ilist, where, done);
+}
+
+#ifdef ARM_32
+static void
+check_ldr(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+          instr_t *where)
+{
+    /* ldr reg1, [mem2] */
+    auto sreg1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    opnd_t mem2 = instr_get_src(instr, 0);
+    uint   size = opnd_size_in_bytes(opnd_get_size(mem2));
+    instr_t *bail = INSTR_CREATE_label(drcontext);
+
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem2, sapp2, sreg1);
+    drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg1);
+    drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, sapp2,
+                                     size > 4 ? 4 : size);
+    auto flags = drreg_aflags_reservation { ilist, where };
+    insert_bail_if_tainted(drcontext, ilist, where, sapp2, bail);
+    if (size == 8) {
+        insert_second_word_to_taint(drcontext, ilist, where, mem2, sapp2, sreg1);
+        drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, sapp2, 4);
+        insert_bail_if_tainted(drcontext, ilist, where, sapp2, bail);
+    }
+    insert_bail(drcontext, ilist, instr, where, bail);
+}
+
+template <stack_dir_t c> static void
+check_ldm(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+          instr_t *where)
+{
+    /* ldm reg1(!), {reg2, reg3, ...} */
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+    auto flags = drreg_aflags_reservation { ilist, where };
+    reg_id_t reg1 = opnd_get_base(instr_get_src(instr, 0));
+    bool writeback = instr_num_srcs(instr) > 1;
+    reg_id_t regs[DR_NUM_GPR_REGS];
+    int top = get_reglist(instr, true, reg1, writeback, regs);
+    instr_t *bail = INSTR_CREATE_label(drcontext);
+
+    drreg_get_app_value(drcontext, ilist, where, reg1, sapp1);
+    for (int i = 0; i < top; ++i) {
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1,
+                        calculate_addr<c>(i, top));
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg2);
+        drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, sapp2, 4);
+        insert_bail_if_tainted(drcontext, ilist, where, sapp2, bail);
+    }
+    insert_bail(drcontext, ilist, instr, where, bail);
+}
+
+static void
+check_simd_load(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                instr_t *where)
+{
+    /* vldm reg1(!), {d2, d3, ...} */
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+    auto flags = drreg_aflags_reservation { ilist, where };
+    opnd_t mem = simd_mem_opnd(instr, false);
+    instr_t *bail = INSTR_CREATE_label(drcontext);
+
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem, sapp1, sreg2);
+    for (int i = 0; i < simd_mem_words(mem); ++i) {
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1, i * 4);
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg2);
+        drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp2, sapp2,
+                                         simd_mem_word_size(mem));
+        insert_bail_if_tainted(drcontext, ilist, where, sapp2, bail);
+    }
+    insert_bail(drcontext, ilist, instr, where, bail);
+}
+
+static void
+clear_simd_store(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                 instr_t *where)
+{
+    /* vstm reg1(!), {d2, d3, ...} */
+    auto sreg1 = drreg_reservation { ilist, where };
+
+    insert_simd_mem_store(drcontext, ilist, instr, where, simd_mem_opnd(instr, true),
+                          DR_REG_NULL, DR_REG_NULL, sreg1);
+}
+
+static void
+clear_str(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+          instr_t *where)
+{
+    /* str [mem2], reg1 */
+    auto sreg1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    opnd_t mem2 = instr_get_dst(instr, 0);
+    uint   size = opnd_size_in_bytes(opnd_get_size(mem2));
+
+    drutil_insert_get_mem_addr(drcontext, ilist, where, mem2, sapp2, sreg1);
+    drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg1);
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                             (drcontext,
+                              opnd_create_reg(sreg1),
+                              OPND_CREATE_INT(0)));
+    drtaint_shadow_insert_store_taint(drcontext, ilist, where, instr_get_app_pc(instr),
+                                      sapp2, sreg1, size > 4 ? 4 : size);
+    if (size == 8) {
+        insert_second_word_to_taint(drcontext, ilist, where, mem2, sapp2, sreg1);
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                                 (drcontext,
+                                  opnd_create_reg(sreg1),
+                                  OPND_CREATE_INT(0)));
+        drtaint_shadow_insert_store_taint(drcontext, ilist, where,
+                                          instr_get_app_pc(instr), sapp2, sreg1, 4);
+    }
+}
+
+template <stack_dir_t c> static void
+clear_stm(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+          instr_t *where)
+{
+    /* stm reg1(!), {reg2, reg3, ...} */
+    auto sapp1 = drreg_reservation { ilist, where };
+    auto sapp2 = drreg_reservation { ilist, where };
+    auto sreg2 = drreg_reservation { ilist, where };
+    reg_id_t reg1 = opnd_get_base(instr_get_dst(instr, 0));
+    bool writeback = instr_num_dsts(instr) > 1;
+    reg_id_t regs[DR_NUM_GPR_REGS];
+    int top = get_reglist(instr, false, reg1, writeback, regs);
 
-    case OP_mov:
-    case OP_mvn:
-    case OP_mvns:
-    case OP_movw:
-    case OP_movt:
-    case OP_movs:
-    case OP_rrx:
-    case OP_rrxs:
-        if (opnd_is_reg(instr_get_src(where, 0)))
-            propagate_mov_reg_src(drcontext, tag, ilist, where);
-        else
-            propagate_mov_imm_src(drcontext, tag, ilist, where);
-        break;
+    drreg_get_app_value(drcontext, ilist, where, reg1, sapp1);
+    for (int i = 0; i < top; ++i) {
+        insert_add_disp(drcontext, ilist, where, sapp2, sapp1,
+                        calculate_addr<c>(i, top));
+        drtaint_insert_app_to_taint(drcontext, ilist, where, sapp2, sreg2);
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                                 (drcontext,
+                                  opnd_create_reg(sreg2),
+                                  OPND_CREATE_INT(0)));
+        drtaint_shadow_insert_store_taint(drcontext, ilist, where,
+                                          instr_get_app_pc(instr), sapp2, sreg2, 4);
+    }
+}
 
-    case OP_sbfx:
-    case OP_ubfx:
-    case OP_uxtb:
-    case OP_uxth:
-    case OP_sxtb:
-    case OP_sxth:
-    case OP_rev:
-    case OP_rev16:
-        /* These aren't mov's per se, but they only accept 1
-         * reg source and 1 reg dest.
-         */
-        propagate_mov_reg_src(drcontext, tag, ilist, where);
+static void
+propagate_instr_clean(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                      instr_t *where)
+{
+    /* No register is tainted, so register to register propagation is a
+     * no-op. Loads must not bring in taint, and stores clear the shadow
+     * of what they overwrite.
+     */
+    switch (instr_get_opcode(instr)) {
+    case OP_ldmia:
+        check_ldm<IA>(drcontext, tag, ilist, instr, where);
         break;
-
-    case OP_sel:
-    case OP_clz:
-        /* These aren't mov's per se, but they only accept 1
-         * reg source and 1 dest.
-         */
-        if (opnd_is_reg(instr_get_src(where, 0)))
-            propagate_mov_reg_src(drcontext, tag, ilist, where);
-        else
-            propagate_mov_imm_src(drcontext, tag, ilist, where);
+    case OP_ldmdb:
+        check_ldm<DB>(drcontext, tag, ilist, instr, where);
         break;
-
-    case OP_adc:
-    case OP_adcs:
-    case OP_add:
-    case OP_adds:
-    case OP_addw:
-    case OP_rsb:
-    case OP_rsbs:
-    case OP_rsc:
-    case OP_sbc:
-    case OP_sbcs:
-    case OP_sub:
-    case OP_subw:
-    case OP_subs:
-    case OP_and:
-    case OP_ands:
-    case OP_bic:
-    case OP_bics:
-    case OP_eor:
-    case OP_eors:
-    case OP_mul:
-    case OP_muls:
-    case OP_orr:
-    case OP_ror:
-    case OP_orrs:
-    case OP_lsl:
-    case OP_lsls:
-    case OP_lsr:
-    case OP_lsrs:
-    case OP_asr:
-    case OP_asrs:
-    case OP_orn:
-    case OP_uadd8:
-    case OP_uqsub8:
-        /* Some of these also write to eflags. If we taint eflags
-         * we should do it here.
-         */
-        DR_ASSERT(instr_num_srcs(where) == 2 || instr_num_srcs(where) == 4);
-        DR_ASSERT(instr_num_dsts(where) == 1);
-        if (opnd_is_reg(instr_get_src(where, 0))) {
-            if (opnd_is_reg(instr_get_src(where, 1)))
-                propagate_arith_reg_reg(drcontext, tag, ilist, where);
-            else
-                propagate_arith_reg_imm(drcontext, tag, ilist, where);
-        } else if (opnd_is_reg(instr_get_src(where, 1)))
-            propagate_arith_imm_reg(drcontext, tag, ilist, where);
-        else
-            DR_ASSERT(false); /* add reg, imm, imm does not make sense */
+    case OP_ldmib:
+        check_ldm<IB>(drcontext, tag, ilist, instr, where);
         break;
-
-    case OP_smull:
-    case OP_umull:
-        propagate_umull(drcontext, tag, ilist, where);
+    case OP_ldmda:
+        check_ldm<DA>(drcontext, tag, ilist, instr, where);
         break;
-
-    case OP_mla:
-    case OP_mls:
-        propagate_mla(drcontext, tag, ilist, where);
+    case OP_stmia:
+        clear_stm<IA>(drcontext, tag, ilist, instr, where);
         break;
-
-    case OP_bl:
-    case OP_blx:
-    case OP_blx_ind:
-        propagate_mov_regs(drcontext, tag, ilist, where,
-                           DR_REG_PC, DR_REG_LR);
-        /* fallthrough, we could have a register dest */
-    case OP_bxj:
-    case OP_bx:
-    case OP_b:
-    case OP_b_short:
-        /* could have register destination */
-        if (opnd_is_reg(instr_get_src(where, 0))) {
-            propagate_mov_regs(drcontext, tag, ilist, where,
-                               opnd_get_reg(instr_get_src(where, 0)),
-                               DR_REG_PC);
-        }
-        /* we don't have to do anything for immediates */
+    case OP_stmdb:
+        clear_stm<DB>(drcontext, tag, ilist, instr, where);
         break;
-
-    case OP_cbz:
-    case OP_cbnz:
-        /* Nothing to do here, unless we want to support tainting
-         * eflags.
-         */
+    case OP_stmib:
+        clear_stm<IB>(drcontext, tag, ilist, instr, where);
         break;
-    case OP_cmn:
-    case OP_cmp:
-    case OP_tst:
-    case OP_it:
-        /* Nothing to do here, unless we want to support tainting
-         * eflags.
-         */
+    case OP_stmda:
+        clear_stm<DA>(drcontext, tag, ilist, instr, where);
         break;
 
-    case OP_LABEL:
-    case OP_svc:
-    case OP_ldc:
-    case OP_mcr:
-    case OP_mrc:
-    case OP_nop:
-    case OP_pld:
-    case OP_dmb:
+    case OP_ldr:
+    case OP_ldrb:
+    case OP_ldrd:
+    case OP_ldrh:
+    case OP_ldrsh:
+    case OP_ldrsb:
+    case OP_ldrex:
+        check_ldr(drcontext, tag, ilist, instr, where);
         break;
 
-    case OP_bfi:
-    case OP_bfc:
-    case OP_teq:
+    case OP_str:
+    case OP_strb:
+    case OP_strd:
+    case OP_strh:
+    case OP_strex:
+        clear_str(drcontext, tag, ilist, instr, where);
         break;
 
     default:
-        unimplemented_opcode(where);
+        if (instr_is_simd(instr)) {
+            if (instr_reads_memory(instr))
+                check_simd_load(drcontext, tag, ilist, instr, where);
+            else if (instr_writes_memory(instr))
+                clear_simd_store(drcontext, tag, ilist, instr, where);
+        }
         break;
     }
+}
+#else
+/* Whether instr reads or writes memory whose taint propagate_x86() would
+ * carry, so the clean copy has to check or clear it.
+ */
+static bool
+x86_clean_accesses_memory(instr_t *instr, bool sources)
+{
+    for (int i = 0; sources && i < instr_num_srcs(instr); i++) {
+        if (opnd_is_memory_reference(instr_get_src(instr, i)) &&
+            instr_get_opcode(instr) != OP_lea)
+            return true;
+    }
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        if (opnd_is_memory_reference(instr_get_dst(instr, i)))
+            return true;
+    }
+    return false;
+}
+
+static void
+propagate_instr_clean(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                      instr_t *where)
+{
+    /* As on ARM, loads must not bring in taint, and stores clear the shadow
+     * of what they overwrite. The sources propagate_x86() ignores need no
+     * check.
+     */
+    if (!instr_is_app(instr) || instr_is_syscall(instr) || !x86_writes_taint(instr))
+        return;
+    bool sources = !instr_is_cti(instr) && !x86_is_zero_idiom(instr);
+    if (!x86_clean_accesses_memory(instr, sources))
+        return;
+
+    auto sapp = drreg_reservation { ilist, where };
+    auto sreg = drreg_reservation { ilist, where };
+    auto flags = drreg_aflags_reservation { ilist, where };
+    instr_t *bail = INSTR_CREATE_label(drcontext);
+    bool checked = false;
+
+    for (int i = 0; sources && i < instr_num_srcs(instr); i++) {
+        opnd_t src = instr_get_src(instr, i);
+        if (!opnd_is_memory_reference(src) || instr_get_opcode(instr) == OP_lea)
+            continue;
+        uint size = x86_mem_size(src);
+        for (uint offs = 0; offs < size; offs += 4) {
+            x86_insert_mem_to_taint(drcontext, ilist, where, src, offs, sapp, sreg);
+            drtaint_shadow_insert_load_taint(drcontext, ilist, where, sapp, sapp,
+                                             size - offs > 4 ? 4 : size - offs);
+            insert_bail_if_tainted(drcontext, ilist, where, sapp, bail);
+        }
+        checked = true;
+    }
+    if (checked)
+        insert_bail(drcontext, ilist, instr, where, bail);
+    else
+        instr_destroy(drcontext, bail);
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        opnd_t dst = instr_get_dst(instr, i);
+        if (!opnd_is_memory_reference(dst))
+            continue;
+        uint size = x86_mem_size(dst);
+        for (uint offs = 0; offs < size; offs += 4) {
+            x86_insert_mem_to_taint(drcontext, ilist, where, dst, offs, sapp, sreg);
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_int
+                                     (drcontext,
+                                      opnd_create_reg(sreg),
+                                      OPND_CREATE_INT32(0)));
+            drtaint_shadow_insert_store_taint(drcontext, ilist, where,
+                                              instr_get_app_pc(instr), sapp, sreg,
+                                              size - offs > 4 ? 4 : size - offs);
+        }
+    }
+}
+#endif
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *ilist, instr_t *instr,
+                      instr_t *where, bool for_trace, bool translating,
+                      uintptr_t encoding, void *user_data, void *orig_analysis_data,
+                      void *case_analysis_data)
+{
+    bb_info_t *bb = (bb_info_t *)case_analysis_data;
+    drtaint_stats_block_t *stats = (drtaint_stats_block_t *)orig_analysis_data;
+    const instr_info_t *info;
+    shadow_fwd_t *fwd;
+
+    /* excluded code costs nothing to propagate, so is not counted */
+    if (stats != NULL && encoding != DRTAINT_CASE_EXCLUDED) {
+        drtaint_stats_block_t *counted = NULL;
+        bool first;
+        if (drbbdup_is_first_instr(drcontext, instr, &first) == DRBBDUP_SUCCESS &&
+            first)
+            counted = stats;
+        else if (for_trace && instr_is_app(instr) &&
+                 instr_get_prev_app(instr) != NULL &&
+                 instr_is_cti(instr_get_prev_app(instr))) {
+            /* each block of a trace counts its own executions */
+            counted = drtaint_stats_lookup(instr_get_app_pc(instr));
+        }
+        if (counted != NULL) {
+            auto sreg1 = drreg_reservation { ilist, where };
+            auto sreg2 = drreg_reservation { ilist, where };
+#ifdef X86_64
+            auto flags = drreg_aflags_reservation { ilist, where };
+#endif
+            drtaint_stats_insert_block_count(drcontext, ilist, where, counted, encoding,
+                                             sreg1, sreg2);
+        }
+        if (encoding != DRTAINT_CASE_CLEAN && instr_is_app(instr) && !translating)
+            drtaint_stats_instrumented(instr);
+    }
+    if (encoding == DRTAINT_CASE_CLEAN) {
+        if (instr_is_app(instr) && instr_follows_svc(drcontext, instr))
+            insert_syscall_return(drcontext, ilist, where, DR_REG_NULL);
+        if (instr_is_app(instr) && clears_excluded_returns() &&
+            instr_follows_call(drcontext, instr))
+            insert_excluded_return(drcontext, ilist, where, true);
+        propagate_instr_clean(drcontext, tag, ilist, instr, where);
+        return DR_EMIT_DEFAULT;
+    }
+    if (!instr_is_app(instr))
+        return DR_EMIT_DEFAULT;
+    if (encoding == DRTAINT_CASE_EXCLUDED) {
+        /* The kernel overwrites r0 for syscalls made here too, so its
+         * shadow is cleared where they return, as in included code.
+         */
+        if (instr_follows_svc(drcontext, instr)) {
+            auto sbase = drreg_reservation { ilist, where };
+            drtaint_shadow_insert_reg_base(drcontext, ilist, where, sbase);
+            insert_syscall_return(drcontext, ilist, where, sbase);
+        }
+        if (instr_is_syscall(instr))
+            propagate_svc(drcontext, tag, ilist, instr, where, DR_REG_NULL);
+        if (clears_excluded_returns())
+            insert_excluded_exit(drcontext, ilist, instr, where);
+        return DR_EMIT_DEFAULT;
+    }
+
+    if (clears_excluded_returns() && instr_follows_call(drcontext, instr))
+        insert_excluded_return(drcontext, ilist, where, false);
 
+    if (bb->cur == 0) {
+        bb_info_reserve_base(drcontext, bb, ilist, where);
+        drtaint_shadow_insert_reg_summary_set(drcontext, ilist, where, bb->sbase);
+    }
+    info = bb_info_next(bb, instr);
+    /* nothing is forwarded across an svc, so this goes straight to memory */
+    if (instr_follows_svc(drcontext, instr))
+        insert_syscall_return(drcontext, ilist, where, bb->sbase);
+    fwd = &bb->fwd;
+    fwd->pc = instr_get_app_pc(instr);
+    fwd->enabled = info->forward;
+    propagate_instr(drcontext, tag, ilist, instr, where, bb->sbase, info);
+    fwd->enabled = false;
+    if (info->flush_after)
+        shadow_fwd_flush(drcontext, fwd, ilist, where, bb->sbase);
+    if (bb->cur == bb->num_instrs) {
+        insert_reg_summary(drcontext, ilist, where, bb);
+        bb_info_unreserve_base(drcontext, bb, ilist, where);
+    }
     return DR_EMIT_DEFAULT;
 }
 
 /* ======================================================================================
  * system call clearing and handling routines
  * ==================================================================================== */
+/* How the post-syscall handler clears the taint of the memory a syscall
+ * wrote. Only syscalls with a kind other than SYSCALL_IGNORE are
+ * intercepted.
+ */
+enum {
+    SYSCALL_IGNORE,
+    /* clear each OUT memarg that drsyscall reports */
+    SYSCALL_MEMARGS,
+    /* clear the bytes read into the buffer in the second arg */
+    SYSCALL_BUFFER,
+    /* clear the bytes read into the iovec array in the second arg */
+    SYSCALL_IOVEC,
+    /* allocate shadow for the memory the syscall gave the app */
+    SYSCALL_ALLOC,
+    /* give back the shadow of the memory the syscall took away */
+    SYSCALL_FREE,
+};
+
+/* Linux on ARM and x86-64 numbers its regular syscalls below this */
+#define SYSCALL_TABLE_SIZE 512
+
+static byte syscall_kind[SYSCALL_TABLE_SIZE];
+
+/* the syscall that maps anonymous memory */
+#ifdef SYS_mmap2
+# define SYS_MMAP SYS_mmap2
+#else
+# define SYS_MMAP SYS_mmap
+#endif
+
+static bool
+syscall_arg_writes_cb(drsys_arg_t *arg, void *user_data)
+{
+    if (TESTANY(DRSYS_PARAM_OUT, arg->mode) &&
+        !TESTANY(DRSYS_PARAM_RETVAL | DRSYS_PARAM_INLINED, arg->mode)) {
+        *(bool *)user_data = true;
+        return false;
+    }
+    return true;
+}
+
+static bool
+syscall_table_cb(drsys_sysnum_t num, drsys_syscall_t *syscall, void *user_data)
+{
+    bool writes = false;
+
+    if (num.secondary != 0 || num.number < 0 || num.number >= SYSCALL_TABLE_SIZE)
+        return true;
+    if (drsys_iterate_arg_types(syscall, syscall_arg_writes_cb, &writes) ==
+        DRMF_SUCCESS && writes)
+        syscall_kind[num.number] = SYSCALL_MEMARGS;
+    return true;
+}
+
+static bool
+syscall_table_init(void)
+{
+    if (drsys_iterate_syscalls(syscall_table_cb, NULL) != DRMF_SUCCESS)
+        return false;
+
+    /* the common syscalls get a fast path that skips drsyscall's iteration */
+    syscall_kind[SYS_read]    = SYSCALL_BUFFER;
+    syscall_kind[SYS_pread64] = SYSCALL_BUFFER;
+    syscall_kind[SYS_readv]   = SYSCALL_IOVEC;
+#ifdef SYS_recv
+    syscall_kind[SYS_recv]    = SYSCALL_BUFFER;
+#endif
+#ifdef SYS_preadv
+    syscall_kind[SYS_preadv]  = SYSCALL_IOVEC;
+#endif
+    syscall_kind[SYS_brk]     = SYSCALL_ALLOC;
+    syscall_kind[SYS_MMAP]    = SYSCALL_ALLOC;
+    syscall_kind[SYS_munmap]  = SYSCALL_FREE;
+
+    for (int i = 0; i < SYSCALL_TABLE_SIZE; ++i) {
+        drsys_sysnum_t num = { i, 0 };
+        if (syscall_kind[i] != SYSCALL_IGNORE &&
+            drsys_filter_syscall(num) != DRMF_SUCCESS)
+            return false;
+    }
+    return true;
+}
+
+/* The app is likely to work on what the kernel wrote next, so the buffer
+ * gets its own shadow now rather than a fault per shadow block later.
+ */
+static void
+clear_syscall_out(void *drcontext, app_pc start, size_t size)
+{
+    drtaint_shadow_alloc_app_range(drcontext, start, size);
+    if (!drtaint_set_app_taint_range(drcontext, start, size, 0))
+        DR_ASSERT(false);
+}
+
 static bool
 drsys_iter_cb(drsys_arg_t *arg, void *drcontext)
 {
@@ -1328,36 +4064,106 @@ drsys_iter_cb(drsys_arg_t *arg, void *drcontext)
     if (arg->pre)
         return true;
 #define TEST(mask, var) (((mask) & (var)) != 0)
-    if (TEST(arg->mode, DRSYS_PARAM_OUT)) {
-        char *buffer = (char *)arg->start_addr;
-        for (int i = 0; i < arg->size; ++i) {
-            if (!drtaint_set_app_taint(drcontext,
-                    (app_pc)buffer + i, 0))
-                DR_ASSERT(false);
-        }
-    }
+    if (TEST(arg->mode, DRSYS_PARAM_OUT))
+        clear_syscall_out(drcontext, arg->start_addr, arg->size);
 #undef TEST
     return true;
 }
 
-static bool
-event_pre_syscall(void *drcontext, int sysnum)
+static void
+clear_syscall_buffer(void *drcontext, size_t len)
+{
+    ptr_uint_t buf;
+
+    if (drsys_pre_syscall_arg(drcontext, 1, &buf) != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    clear_syscall_out(drcontext, (app_pc)buf, len);
+}
+
+static void
+clear_syscall_iovec(void *drcontext, size_t len)
 {
-    if (drsys_iterate_memargs(drcontext, drsys_iter_cb, drcontext) !=
-        DRMF_SUCCESS)
+    ptr_uint_t iovs, count;
+    struct iovec iov;
+
+    if (drsys_pre_syscall_arg(drcontext, 1, &iovs) != DRMF_SUCCESS ||
+        drsys_pre_syscall_arg(drcontext, 2, &count) != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    /* the kernel fills each iovec in turn */
+    for (ptr_uint_t i = 0; i < count && len > 0; ++i) {
+        if (!dr_safe_read((struct iovec *)iovs + i, sizeof(iov), &iov, NULL))
+            break;
+        size_t n = iov.iov_len < len ? iov.iov_len : len;
+        clear_syscall_out(drcontext, (app_pc)iov.iov_base, n);
+        len -= n;
+    }
+}
+
+/* the program break as of the last brk we saw, guarded by brk_lock */
+static app_pc brk_end;
+
+static void
+alloc_shadow_for_syscall(void *drcontext, int sysnum, ptr_uint_t result)
+{
+    ptr_uint_t prot, flags, len;
+
+    /* Shadow memory that the app can now write, to save it faulting in a
+     * shadow block at a time.
+     */
+    switch (sysnum) {
+    case SYS_brk:
+        /* Another thread's brk may move the break between two of ours, so
+         * the comparison and the update happen together.
+         */
+        dr_mutex_lock(brk_lock);
+        if (brk_end != NULL && (app_pc)result > brk_end) {
+            drtaint_shadow_alloc_app_range(drcontext, brk_end,
+                                           (app_pc)result - brk_end);
+        } else if (brk_end != NULL && (app_pc)result < brk_end) {
+            drtaint_shadow_free_app_range(drcontext, (app_pc)result,
+                                          brk_end - (app_pc)result);
+        }
+        brk_end = (app_pc)result;
+        dr_mutex_unlock(brk_lock);
+        break;
+    case SYS_MMAP:
+        if (drsys_pre_syscall_arg(drcontext, 1, &len) != DRMF_SUCCESS ||
+            drsys_pre_syscall_arg(drcontext, 2, &prot) != DRMF_SUCCESS ||
+            drsys_pre_syscall_arg(drcontext, 3, &flags) != DRMF_SUCCESS)
+            break;
+        if (TESTANY(MAP_ANONYMOUS, flags) && TESTANY(PROT_WRITE, prot))
+            drtaint_shadow_alloc_app_range(drcontext, (app_pc)result, len);
+        break;
+    }
+}
+
+static void
+free_shadow_for_syscall(void *drcontext)
+{
+    ptr_uint_t addr, len;
+
+    /* Once the memory is unmapped no app access can be using its shadow,
+     * so its blocks can go back to umbra.
+     */
+    if (drsys_pre_syscall_arg(drcontext, 0, &addr) != DRMF_SUCCESS ||
+        drsys_pre_syscall_arg(drcontext, 1, &len) != DRMF_SUCCESS ||
+        !drtaint_shadow_free_app_range(drcontext, (app_pc)addr, len))
         DR_ASSERT(false);
-    return true;
 }
 
 static void
 event_post_syscall(void *drcontext, int sysnum)
 {
     dr_syscall_result_info_t info = { sizeof(info), };
-    dr_syscall_get_result_ex(drcontext, &info);
+    byte kind = sysnum >= 0 && sysnum < SYSCALL_TABLE_SIZE ?
+        syscall_kind[sysnum] : SYSCALL_IGNORE;
 
-    /* all syscalls untaint rax */
-    drtaint_set_reg_taint(drcontext, DR_REG_R0, 0);
+    drtaint_shadow_syscall_returned(drcontext);
+    /* another client may have intercepted a syscall we have no work for */
+    if (kind == SYSCALL_IGNORE)
+        return;
 
+    dr_syscall_get_result_ex(drcontext, &info);
     if (!info.succeeded) {
         /* We only care about tainting if the syscall
          * succeeded.
@@ -1365,8 +4171,24 @@ event_post_syscall(void *drcontext, int sysnum)
         return;
     }
 
-    /* clear taint for system calls with an OUT memarg param */
-    if (drsys_iterate_memargs(drcontext, drsys_iter_cb, drcontext) !=
-        DRMF_SUCCESS)
-        DR_ASSERT(false);
+    switch (kind) {
+    case SYSCALL_BUFFER:
+        clear_syscall_buffer(drcontext, info.value);
+        break;
+    case SYSCALL_IOVEC:
+        clear_syscall_iovec(drcontext, info.value);
+        break;
+    case SYSCALL_ALLOC:
+        alloc_shadow_for_syscall(drcontext, sysnum, info.value);
+        break;
+    case SYSCALL_FREE:
+        free_shadow_for_syscall(drcontext);
+        break;
+    default:
+        /* clear taint for system calls with an OUT memarg param */
+        if (drsys_iterate_memargs(drcontext, drsys_iter_cb, drcontext) !=
+            DRMF_SUCCESS)
+            DR_ASSERT(false);
+        break;
+    }
 }
@@ -2,6 +2,7 @@
 #define DRTAINT_H_
 
 #include "dr_api.h"
+#include "drtaint_scan.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,15 +12,116 @@ enum {
     DRMGR_PRIORITY_INSERT_DRTAINT      = -7500,
     DRMGR_PRIORITY_THREAD_INIT_DRTAINT = -7500,
     DRMGR_PRIORITY_THREAD_EXIT_DRTAINT =  7500,
+    DRMGR_PRIORITY_POST_SYSCALL_DRTAINT = -7500,
 };
 
 #define DRMGR_PRIORITY_NAME_DRTAINT "drtaint"
 #define DRMGR_PRIORITY_NAME_DRTAINT_EXIT "drtaint.exit"
 #define DRMGR_PRIORITY_NAME_DRTAINT_INIT "drtaint.init"
+#define DRMGR_PRIORITY_NAME_DRTAINT_SYSCALL "drtaint.syscall"
+
+typedef enum {
+    /* one shadow byte for each aligned 4-byte word of memory */
+    DRTAINT_GRANULARITY_WORD,
+    /* one shadow byte for each byte of memory */
+    DRTAINT_GRANULARITY_BYTE,
+} drtaint_granularity_t;
+
+typedef enum {
+    /* Each taint value is a byte whose bits are independent labels, and
+     * values combine by bitwise or.
+     */
+    DRTAINT_LABELS_BITS,
+    /* Each taint value is the 16-bit ID of a set of labels, see
+     * drtaint_label_create(). This doubles the shadow memory, and combining
+     * two distinct sets calls out of the code cache.
+     */
+    DRTAINT_LABELS_SETS,
+} drtaint_label_mode_t;
+
+typedef enum {
+    /* record nothing */
+    DRTAINT_ORIGINS_OFF,
+    /* Record each instruction that writes a nonzero shadow value to a
+     * register or to memory, in a per-thread ring of about the last
+     * DRTAINT_ORIGINS_MAX of them, see drtaint_get_origins(). This costs a
+     * few instructions per propagated write.
+     */
+    DRTAINT_ORIGINS_WRITE,
+} drtaint_origin_mode_t;
+
+#define DRTAINT_ORIGINS_MAX 256
+
+/* What excluded code, see drtaint_options_t.exclude, does to register taint */
+typedef enum {
+    /* Where excluded code returns to included code, the registers the
+     * callee may clobber under the calling convention are cleared, as if
+     * it only produced untainted results: r0-r3, r12, lr, d0-d7 and
+     * d16-d31 on ARM, and rax, rcx, rdx, rsi, rdi, r8-r11 and the xmm
+     * registers on x86-64. Callee-saved registers and sp keep their taint.
+     * Returns within excluded code, and calls and jumps from it into
+     * included code, such as to a callback, clear nothing. A return is
+     * recognised by its target following a call instruction. The default.
+     */
+    DRTAINT_EXCLUDED_CLEAR,
+    /* Registers keep the taint they had, whatever the excluded code wrote
+     * to them.
+     */
+    DRTAINT_EXCLUDED_KEEP,
+} drtaint_excluded_policy_t;
+
+typedef struct _drtaint_options_t {
+    /* Set to the size of this structure */
+    size_t struct_size;
+    /* The amount of memory each shadow value covers. Byte granularity
+     * avoids tainting or clearing whole words on sub-word accesses, at the
+     * cost of four times the shadow memory.
+     */
+    drtaint_granularity_t granularity;
+    /* What a shadow value holds */
+    drtaint_label_mode_t label_mode;
+    /* Whether to record where taint may have come from */
+    drtaint_origin_mode_t origin_mode;
+    /* If not NULL, count instrumented and executed opcodes and the calls
+     * out of the code cache, and write them to this file as JSON at exit.
+     * The counting costs an update of a per-thread counter per block
+     * execution, and the first 65536 blocks are counted.
+     */
+    const char *stats_path;
+    /* If nonzero, measure the time, meta instructions and drreg spills
+     * that instrumenting each block costs, and print the costliest this
+     * many functions and modules to stderr at exit.
+     */
+    uint profile_top;
+    /* Unless both are NULL or empty, propagate only through code in the
+     * included and not in the excluded modules and address ranges. Each is
+     * a comma-separated list of modules' preferred names, such as
+     * libc.so.6, and of ranges written 0xstart-0xend, end exclusive.
+     * Excluded code gets no propagation, and neither does memory it
+     * writes.
+     */
+    const char *include;
+    const char *exclude;
+    drtaint_excluded_policy_t excluded_policy;
+    /* Within a block, the shadow of a register other than pc may be held in
+     * a scratch register and only written to its slot later, see
+     * drtaint_insert_reg_to_taint(). Set this if clean calls or other code
+     * that doesn't go through drtaint_insert_reg_to_taint() read or write
+     * register taint between app instructions, e.g. with
+     * drtaint_get_reg_taint().
+     */
+    bool no_forwarding;
+} drtaint_options_t;
+
+/* The label set standing in for any set once the 16-bit IDs run out */
+#define DRTAINT_LABEL_SET_UNKNOWN 0xffff
 
 bool
 drtaint_init(client_id_t id);
 
+bool
+drtaint_init_ex(client_id_t id, const drtaint_options_t *ops);
+
 void
 drtaint_exit(void);
 
@@ -27,6 +129,13 @@ bool
 drtaint_insert_app_to_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
                             reg_id_t reg_addr, reg_id_t scratch);
 
+/* Within a block, the shadow of a register other than pc may be held in a
+ * scratch register and only written to its slot at the next branch,
+ * syscall or predicated instruction. Unless shadow is pc, whose slot is
+ * always current, this writes any such values back before it computes the
+ * address, so the code inserted up to the next app instruction sees and
+ * may change every register's taint in memory.
+ */
 bool
 drtaint_insert_reg_to_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
                             reg_id_t shadow, reg_id_t regaddr);
@@ -40,9 +149,91 @@ drtaint_set_reg_taint(void *drcontext, reg_id_t reg, byte value);
 bool
 drtaint_get_app_taint(void *drcontext, app_pc app, byte *result);
 
+/* The taint functions taking a byte only see the low byte of a label set
+ * ID. These take the whole value in either label mode.
+ */
+bool
+drtaint_get_reg_label(void *drcontext, reg_id_t reg, uint *label);
+
+bool
+drtaint_set_reg_label(void *drcontext, reg_id_t reg, uint label);
+
+bool
+drtaint_get_app_label(void *drcontext, app_pc app, uint *label);
+
+bool
+drtaint_set_app_label(void *drcontext, app_pc app, uint label);
+
+bool
+drtaint_set_app_label_range(void *drcontext, app_pc start, size_t size, uint label);
+
 bool
 drtaint_set_app_taint(void *drcontext, app_pc app, byte result);
 
+/* Reads the taint of every byte in [start, start + size) into result, which
+ * must hold size bytes. Fails with DRTAINT_LABELS_SETS.
+ */
+bool
+drtaint_get_app_taint_range(void *drcontext, app_pc start, size_t size, byte *result);
+
+/* Stores the union of the taint of every byte in [start, start + size) in
+ * label. The drtaint_scan_* kernels do the same for a buffer of labels.
+ * Fails with DRTAINT_LABELS_SETS.
+ */
+bool
+drtaint_get_app_taint_union(void *drcontext, app_pc start, size_t size, byte *label);
+
+/* Sets found to whether any byte in [start, start + size) is tainted,
+ * storing the first such byte and its taint in first_tainted and label when
+ * they are not NULL. Untouched shadow blocks are skipped without being
+ * read. Returns false, and leaves found unset, if the shadow could not be
+ * read; a sink should then assume the range is tainted. Fails with
+ * DRTAINT_LABELS_SETS.
+ */
+bool
+drtaint_find_tainted(void *drcontext, app_pc start, size_t size, bool *found,
+                     app_pc *first_tainted, byte *label);
+
+/* Sets the taint of every byte in [start, start + size) to value. Shadow
+ * blocks are written a range at a time, and clearing skips blocks that
+ * were never tainted, so this is much cheaper than calling
+ * drtaint_set_app_taint for each byte.
+ */
+bool
+drtaint_set_app_taint_range(void *drcontext, app_pc start, size_t size, byte value);
+
+/* Stores the bytes of shadow memory currently allocated in bytes */
+bool
+drtaint_get_shadow_usage(size_t *bytes);
+
+/* Stores up to max of the calling thread's recorded origins in pcs, most
+ * recent first, and returns how many it stored. Repeated writes by one
+ * instruction are stored once. Sinks can use this to see which code moved
+ * tainted values just before a leak.
+ */
+size_t
+drtaint_get_origins(void *drcontext, app_pc *pcs, size_t max);
+
+/* Label sets, for DRTAINT_LABELS_SETS only. ID 0 is the empty set. */
+
+/* Returns the ID of a set holding a new label, which is also the label's
+ * own number, or 0 if the IDs have run out.
+ */
+uint
+drtaint_label_create(void);
+
+/* Returns the ID of the union of two label sets. Repeated unions of the
+ * same pair are answered from a lock-free cache.
+ */
+uint
+drtaint_label_union(uint set1, uint set2);
+
+/* Stores up to max of the set's labels in labels, and returns how many
+ * labels the set holds.
+ */
+size_t
+drtaint_label_set_members(uint set, uint *labels, size_t max);
+
 #ifdef __cplusplus
 }
 #endif
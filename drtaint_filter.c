@@ -0,0 +1,231 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drtaint_filter.h"
+
+/* Module names are matched once, as each module loads, and a matching
+ * module's segments join the listed address ranges. Deciding a block is
+ * then a scan of the ranges, which stay few.
+ */
+typedef struct _filter_range_t {
+    app_pc start;
+    app_pc end;
+    bool exclude;
+    /* the start of the module the range was added for, or NULL if listed */
+    app_pc module;
+} filter_range_t;
+
+typedef struct _filter_list_t {
+    /* a copy of the list, split into NUL-terminated names in place */
+    char *buf;
+    size_t buf_size;
+    const char **names;
+    uint max_names;
+    uint num_names;
+} filter_list_t;
+
+enum {
+    LIST_INCLUDE,
+    LIST_EXCLUDE,
+    LIST_COUNT,
+};
+
+static bool enabled;
+static bool have_includes;
+static filter_list_t lists[LIST_COUNT];
+static filter_range_t *ranges;
+static uint num_ranges;
+static uint max_ranges;
+static void *ranges_lock;
+
+static void
+event_module_load(void *drcontext, const module_data_t *info, bool loaded);
+
+static void
+event_module_unload(void *drcontext, const module_data_t *info);
+
+/* The caller holds ranges_lock, if it has been created */
+static void
+add_range(app_pc start, app_pc end, bool exclude, app_pc module)
+{
+    if (num_ranges == max_ranges) {
+        uint max = max_ranges == 0 ? 16 : max_ranges * 2;
+        filter_range_t *grown = dr_global_alloc(max * sizeof(*grown));
+        if (num_ranges > 0)
+            memcpy(grown, ranges, num_ranges * sizeof(*grown));
+        if (ranges != NULL)
+            dr_global_free(ranges, max_ranges * sizeof(*ranges));
+        ranges = grown;
+        max_ranges = max;
+    }
+    ranges[num_ranges].start = start;
+    ranges[num_ranges].end = end;
+    ranges[num_ranges].exclude = exclude;
+    ranges[num_ranges].module = module;
+    num_ranges++;
+}
+
+/* Parses 0xstart-0xend. Anything else is taken as a module name. */
+static bool
+parse_range(const char *entry, app_pc *start, app_pc *end)
+{
+    char *pos;
+
+    if (strncmp(entry, "0x", 2) != 0)
+        return false;
+    *start = (app_pc)strtoul(entry, &pos, 16);
+    if (*pos != '-')
+        return false;
+    *end = (app_pc)strtoul(pos + 1, &pos, 16);
+    return *pos == '\0' && *end > *start;
+}
+
+static void
+parse_list(const char *spec, int which)
+{
+    filter_list_t *list = &lists[which];
+    char *entry, *next;
+    app_pc start, end;
+
+    if (spec == NULL || spec[0] == '\0')
+        return;
+    list->buf_size = strlen(spec) + 1;
+    list->buf = dr_global_alloc(list->buf_size);
+    memcpy(list->buf, spec, list->buf_size);
+    list->max_names = 1;
+    for (entry = list->buf; *entry != '\0'; entry++) {
+        if (*entry == ',')
+            list->max_names++;
+    }
+    list->names = dr_global_alloc(list->max_names * sizeof(*list->names));
+    for (entry = list->buf; entry != NULL; entry = next) {
+        next = strchr(entry, ',');
+        if (next != NULL)
+            *next++ = '\0';
+        if (entry[0] == '\0')
+            continue;
+        if (parse_range(entry, &start, &end))
+            add_range(start, end, which == LIST_EXCLUDE, NULL);
+        else
+            list->names[list->num_names++] = entry;
+        if (which == LIST_INCLUDE)
+            have_includes = true;
+    }
+}
+
+bool
+drtaint_filter_init(const char *include, const char *exclude)
+{
+    if ((include == NULL || include[0] == '\0') &&
+        (exclude == NULL || exclude[0] == '\0'))
+        return true;
+    parse_list(include, LIST_INCLUDE);
+    parse_list(exclude, LIST_EXCLUDE);
+    ranges_lock = dr_mutex_create();
+    if (lists[LIST_INCLUDE].num_names > 0 || lists[LIST_EXCLUDE].num_names > 0) {
+        if (!drmgr_register_module_load_event(event_module_load) ||
+            !drmgr_register_module_unload_event(event_module_unload))
+            return false;
+    }
+    enabled = true;
+    return true;
+}
+
+static bool
+list_has(const filter_list_t *list, const char *name)
+{
+    for (uint i = 0; i < list->num_names; i++) {
+        if (strcmp(list->names[i], name) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void
+event_module_load(void *drcontext, const module_data_t *info, bool loaded)
+{
+    const char *name = dr_module_preferred_name(info);
+
+    if (name == NULL)
+        return;
+    dr_mutex_lock(ranges_lock);
+    for (int which = 0; which < LIST_COUNT; which++) {
+        if (!list_has(&lists[which], name))
+            continue;
+        for (uint i = 0; i < info->num_segments; i++) {
+            add_range(info->segments[i].start, info->segments[i].end,
+                      which == LIST_EXCLUDE, info->start);
+        }
+    }
+    dr_mutex_unlock(ranges_lock);
+}
+
+static void
+event_module_unload(void *drcontext, const module_data_t *info)
+{
+    uint kept = 0;
+
+    dr_mutex_lock(ranges_lock);
+    for (uint i = 0; i < num_ranges; i++) {
+        if (ranges[i].module != info->start)
+            ranges[kept++] = ranges[i];
+    }
+    num_ranges = kept;
+    dr_mutex_unlock(ranges_lock);
+}
+
+bool
+drtaint_filter_enabled(void)
+{
+    return enabled;
+}
+
+bool
+drtaint_filter_includes(app_pc pc)
+{
+    bool included, excluded = false;
+
+    if (!enabled)
+        return true;
+    included = !have_includes;
+    dr_mutex_lock(ranges_lock);
+    for (uint i = 0; i < num_ranges; i++) {
+        if (pc < ranges[i].start || pc >= ranges[i].end)
+            continue;
+        if (ranges[i].exclude)
+            excluded = true;
+        else
+            included = true;
+    }
+    dr_mutex_unlock(ranges_lock);
+    return included && !excluded;
+}
+
+void
+drtaint_filter_exit(void)
+{
+    if (!enabled)
+        return;
+    if (lists[LIST_INCLUDE].num_names > 0 || lists[LIST_EXCLUDE].num_names > 0) {
+        drmgr_unregister_module_load_event(event_module_load);
+        drmgr_unregister_module_unload_event(event_module_unload);
+    }
+    for (int which = 0; which < LIST_COUNT; which++) {
+        filter_list_t *list = &lists[which];
+        if (list->buf == NULL)
+            continue;
+        dr_global_free(list->names, list->max_names * sizeof(*list->names));
+        dr_global_free(list->buf, list->buf_size);
+        memset(list, 0, sizeof(*list));
+    }
+    if (ranges != NULL)
+        dr_global_free(ranges, max_ranges * sizeof(*ranges));
+    ranges = NULL;
+    num_ranges = 0;
+    max_ranges = 0;
+    dr_mutex_destroy(ranges_lock);
+    have_includes = false;
+    enabled = false;
+}
@@ -0,0 +1,36 @@
+#ifndef DRTAINT_FILTER_H_
+#define DRTAINT_FILTER_H_
+
+#include "dr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Which code drtaint propagates through, from drtaint_options_t.include
+ * and exclude. Each list is comma-separated, and an entry is either a
+ * module's preferred name, such as libc.so.6, or a range of addresses
+ * written 0xstart-0xend, end exclusive.
+ */
+bool
+drtaint_filter_init(const char *include, const char *exclude);
+
+void
+drtaint_filter_exit(void);
+
+/* Whether any code may be excluded */
+bool
+drtaint_filter_enabled(void);
+
+/* Whether the block starting at pc is propagated through: it is in an
+ * included module or range, or nothing is included, and it is in no
+ * excluded one.
+ */
+bool
+drtaint_filter_includes(app_pc pc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,32 +2,218 @@
 #include <unordered_set>
 #include <exception>
 
+#include "drmgr.h"
 #include "drtaint_helper.h"
+#include "drtaint_stats.h"
+#include "drtaint_profile.h"
+
+static int scope_tls = -1;
+
+/* the registers a scope may take, with avoid's bits indexed from the first */
+#ifdef ARM_32
+# define SCRATCH_REG_FIRST DR_REG_R0
+# define SCRATCH_REG_LAST  DR_REG_LR
+#else
+# define SCRATCH_REG_FIRST DR_REG_START_GPR
+# define SCRATCH_REG_LAST  DR_REG_STOP_GPR
+#endif
+
+bool
+drreg_block_scratch_init(void)
+{
+    scope_tls = drmgr_register_tls_field();
+    return scope_tls != -1;
+}
+
+void
+drreg_block_scratch_exit(void)
+{
+    drmgr_unregister_tls_field(scope_tls);
+}
+
+drreg_block_scratch *
+drreg_block_scratch::active(void *drcontext)
+{
+    return (drreg_block_scratch *)drmgr_get_tls_field(drcontext, scope_tls);
+}
+
+void
+drreg_block_scratch::
+acquire(void *drcontext, instrlist_t *ilist, instr_t *where, uint avoid)
+{
+    instr_t *mark = drtaint_profile_mark(ilist, where);
+    drvector_t allowed;
+    int num_free = 0;
+
+    /* Registers the app never touches in the block cost one spill here and
+     * one restore at the block's end, and nothing in between. We don't
+     * take registers the app uses, whose every access would need drreg to
+     * restore and re-spill them.
+     */
+    drreg_init_and_fill_vector(&allowed, false);
+    for (reg_id_t reg = SCRATCH_REG_FIRST; reg <= SCRATCH_REG_LAST; reg++) {
+        if ((avoid & (1u << (reg - SCRATCH_REG_FIRST))) != 0 ||
+            reg == dr_get_stolen_reg() || reg == IF_X86_ELSE(DR_REG_XSP, DR_REG_SP))
+            continue;
+        drreg_set_vector_entry(&allowed, reg, true);
+        num_free++;
+    }
+    num_ = 0;
+    busy_ = 0;
+    while (num_ < max_regs && num_ < num_free &&
+           drreg_reserve_register(drcontext, ilist, where, &allowed, &regs_[num_]) ==
+           DRREG_SUCCESS)
+        num_++;
+    drvector_delete(&allowed);
+    drtaint_profile_count_spills(drcontext, ilist, mark, where);
+    drmgr_set_tls_field(drcontext, scope_tls, this);
+}
+
+void
+drreg_block_scratch::
+release(void *drcontext, instrlist_t *ilist, instr_t *where)
+{
+    instr_t *mark = drtaint_profile_mark(ilist, where);
+
+    DR_ASSERT(busy_ == 0);
+    drmgr_set_tls_field(drcontext, scope_tls, NULL);
+    for (int i = 0; i < num_; i++)
+        drreg_unreserve_register(drcontext, ilist, where, regs_[i]);
+    num_ = 0;
+    drtaint_profile_count_spills(drcontext, ilist, mark, where);
+}
+
+bool
+drreg_block_scratch::
+take(reg_id_t *reg)
+{
+    for (int i = 0; i < num_; i++) {
+        if ((busy_ & (1u << i)) == 0) {
+            busy_ |= 1u << i;
+            *reg = regs_[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+drreg_block_scratch::
+give(reg_id_t reg)
+{
+    for (int i = 0; i < num_; i++) {
+        if (regs_[i] == reg)
+            busy_ &= ~(1u << i);
+    }
+}
+
+int
+drreg_block_scratch::
+available() const
+{
+    int num = 0;
+
+    for (int i = 0; i < num_; i++) {
+        if ((busy_ & (1u << i)) == 0)
+            num++;
+    }
+    return num;
+}
 
 drreg_reservation::
 drreg_reservation(instrlist_t *ilist, instr_t *where)
     : drcontext_(dr_get_current_drcontext()),
       ilist_(ilist), where_(where)
 {
+    instr_t *mark;
+
+    scope_ = drreg_block_scratch::active(drcontext_);
+    if (scope_ != NULL && scope_->take(&reg_))
+        return;
+    scope_ = NULL;
+    mark = drtaint_profile_mark(ilist_, where_);
     if (drreg_reserve_register(drcontext_, ilist_, where_, NULL, &reg_) != DRREG_SUCCESS)
         throw std::exception();
+    drtaint_profile_count_spills(drcontext_, ilist_, mark, where_);
 }
 
 drreg_reservation::
 ~drreg_reservation()
 {
+    instr_t *mark;
+
+    if (scope_ != NULL) {
+        scope_->give(reg_);
+        return;
+    }
+    mark = drtaint_profile_mark(ilist_, where_);
     drreg_unreserve_register(drcontext_, ilist_, where_, reg_);
+    drtaint_profile_count_spills(drcontext_, ilist_, mark, where_);
+}
+
+bool
+drtaint_reserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where,
+                       bool may_spill)
+{
+    instr_t *mark = drtaint_profile_mark(ilist, where);
+    bool dead;
+
+    /* Propagation in a block scope is flag-neutral: it may only use the
+     * flags where they are dead, so that drreg never saves them. Label set
+     * unions can't avoid them and are the exception.
+     */
+    if (drreg_are_aflags_dead(drcontext, where, &dead) != DRREG_SUCCESS || !dead) {
+        DR_ASSERT(may_spill || drreg_block_scratch::active(drcontext) == NULL);
+        drtaint_profile_count_flag_spill(drcontext);
+    }
+    if (drreg_reserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS)
+        return false;
+    drtaint_profile_count_spills(drcontext, ilist, mark, where);
+    return true;
+}
+
+bool
+drtaint_unreserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where)
+{
+    instr_t *mark = drtaint_profile_mark(ilist, where);
+
+    if (drreg_unreserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS)
+        return false;
+    drtaint_profile_count_spills(drcontext, ilist, mark, where);
+    return true;
+}
+
+drreg_aflags_reservation::
+drreg_aflags_reservation(instrlist_t *ilist, instr_t *where)
+    : drcontext_(dr_get_current_drcontext()),
+      ilist_(ilist), where_(where)
+{
+    if (!drtaint_reserve_aflags(drcontext_, ilist_, where_, false))
+        throw std::exception();
+}
+
+drreg_aflags_reservation::
+~drreg_aflags_reservation()
+{
+    drtaint_unreserve_aflags(drcontext_, ilist_, where_);
 }
 
 void
 unimplemented_opcode(instr_t *where)
 {
-    /* N/A */
+    drtaint_stats_unimplemented(instr_get_opcode(where), false);
+}
+
+void
+approximate_simd_opcode(instr_t *where)
+{
+    drtaint_stats_unimplemented(instr_get_opcode(where), true);
 }
 
 void
-instrlist_meta_preinsert_xl8(instrlist_t *ilist, instr_t *where, instr_t *insert)
+instrlist_meta_preinsert_xl8(instrlist_t *ilist, instr_t *instr, instr_t *where,
+                             instr_t *insert)
 {
     instrlist_meta_preinsert(ilist, where, INSTR_XL8
-                             (insert, instr_get_app_pc(where)));
+                             (insert, instr_get_app_pc(instr)));
 }
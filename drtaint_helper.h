@@ -8,6 +8,45 @@
 extern "C" {
 #endif
 
+/* Reserves the arithmetic flags with drreg. In a block scope the flags must
+ * be dead at where unless may_spill is set, in which case drreg saving
+ * them is counted in the profile.
+ */
+bool
+drtaint_reserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where,
+                       bool may_spill);
+
+bool
+drtaint_unreserve_aflags(void *drcontext, instrlist_t *ilist, instr_t *where);
+
+#ifdef __cplusplus
+/* Scratch registers held across a run of app instructions. While a block
+ * scope is active on a thread, drreg_reservation takes its register from
+ * the scope and hands it back on destruction, so consecutive instructions
+ * reuse the same registers instead of drreg spilling and restoring them
+ * around each one. Reservations beyond the scope's registers go to drreg.
+ */
+class drreg_block_scratch {
+public:
+    enum { max_regs = 5 };
+    drreg_block_scratch() : num_(0), busy_(0) {}
+    /* Reserves up to max_regs registers outside avoid, a mask of registers
+     * indexed from DR_REG_R0 (DR_REG_START_GPR on x86), and activates the
+     * scope.
+     */
+    void acquire(void *drcontext, instrlist_t *ilist, instr_t *where, uint avoid);
+    void release(void *drcontext, instrlist_t *ilist, instr_t *where);
+    bool take(reg_id_t *reg);
+    void give(reg_id_t reg);
+    /* the number of registers take() can still hand out */
+    int available() const;
+    static drreg_block_scratch *active(void *drcontext);
+private:
+    reg_id_t regs_[max_regs];
+    int num_;
+    uint busy_;
+};
+
 class drreg_reservation {
 public:
     drreg_reservation(instrlist_t *ilist, instr_t *where);
@@ -18,13 +57,35 @@ private:
     instr_t *where_;
     reg_id_t reg_;
     void *drcontext_;
+    drreg_block_scratch *scope_; /* NULL if reserved from drreg */
+};
+
+class drreg_aflags_reservation {
+public:
+    drreg_aflags_reservation(instrlist_t *ilist, instr_t *where);
+    ~drreg_aflags_reservation();
+private:
+    instrlist_t *ilist_;
+    instr_t *where_;
+    void *drcontext_;
 };
+#endif
+
+bool
+drreg_block_scratch_init(void);
+
+void
+drreg_block_scratch_exit(void);
 
 void
 unimplemented_opcode(instr_t *where);
 
 void
-instrlist_meta_preinsert_xl8(instrlist_t *ilist, instr_t *where, instr_t *insert);
+approximate_simd_opcode(instr_t *where);
+
+void
+instrlist_meta_preinsert_xl8(instrlist_t *ilist, instr_t *instr, instr_t *where,
+                             instr_t *insert);
 
 #ifdef __cplusplus
 }
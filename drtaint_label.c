@@ -0,0 +1,223 @@
+#include <string.h>
+
+#include "dr_api.h"
+#include "drtaint.h"
+#include "drtaint_label.h"
+
+/* Label sets are hash-consed: each distinct set of labels is stored once
+ * and named by a 16-bit ID, so that comparing IDs compares sets. A label
+ * is the ID of the set holding only it. The table only grows.
+ */
+typedef struct _label_set_t {
+    struct _label_set_t *next; /* in its hash bucket */
+    uint hash;
+    uint id;
+    uint size;
+    ushort members[]; /* sorted */
+} label_set_t;
+
+#define LABEL_SET_BYTES(size) (sizeof(label_set_t) + (size) * sizeof(ushort))
+
+#define NUM_SETS (DRTAINT_LABEL_SET_UNKNOWN + 1)
+#define NUM_BUCKETS 4096
+
+static label_set_t **sets;
+static label_set_t **buckets;
+static uint num_sets;
+static void *table_lock;
+
+/* A direct-mapped cache of unions, read without locks. A writer claims an
+ * entry by swapping its key for UNION_BUSY, so a reader that sees the same
+ * key before and after reading the value has a matching value. Keys pack
+ * the smaller ID above the larger, so are never zero or UNION_BUSY.
+ */
+typedef struct _union_entry_t {
+    uint key;
+    uint value;
+} union_entry_t;
+
+#define UNION_CACHE_SIZE 4096
+#define UNION_BUSY 0xffffffff
+
+static union_entry_t *union_cache;
+
+static uint
+union_key(uint set1, uint set2)
+{
+    return set1 < set2 ? (set1 << 16) | set2 : (set2 << 16) | set1;
+}
+
+static union_entry_t *
+union_entry(uint key)
+{
+    return &union_cache[(key * 2654435761u) >> 20];
+}
+
+static uint
+hash_members(const ushort *members, uint size)
+{
+    uint hash = 2166136261u;
+    for (uint i = 0; i < size; i++)
+        hash = (hash ^ members[i]) * 16777619u;
+    return hash;
+}
+
+bool
+drtaint_label_init(void)
+{
+    sets = dr_global_alloc(NUM_SETS * sizeof(*sets));
+    buckets = dr_global_alloc(NUM_BUCKETS * sizeof(*buckets));
+    union_cache = dr_global_alloc(UNION_CACHE_SIZE * sizeof(*union_cache));
+    table_lock = dr_mutex_create();
+    memset(sets, 0, NUM_SETS * sizeof(*sets));
+    memset(buckets, 0, NUM_BUCKETS * sizeof(*buckets));
+    memset(union_cache, 0, UNION_CACHE_SIZE * sizeof(*union_cache));
+    /* ID 0 is the empty set */
+    num_sets = 1;
+    return true;
+}
+
+void
+drtaint_label_exit(void)
+{
+    for (uint i = 1; i < num_sets; i++)
+        dr_global_free(sets[i], LABEL_SET_BYTES(sets[i]->size));
+    dr_global_free(sets, NUM_SETS * sizeof(*sets));
+    dr_global_free(buckets, NUM_BUCKETS * sizeof(*buckets));
+    dr_global_free(union_cache, UNION_CACHE_SIZE * sizeof(*union_cache));
+    dr_mutex_destroy(table_lock);
+    sets = NULL;
+}
+
+/* Returns the ID of the set with these members, adding it if need be.
+ * The caller holds table_lock.
+ */
+static uint
+intern_set(const ushort *members, uint size)
+{
+    uint hash = hash_members(members, size);
+    label_set_t **bucket = &buckets[hash % NUM_BUCKETS];
+    label_set_t *set;
+
+    for (set = *bucket; set != NULL; set = set->next) {
+        if (set->hash == hash && set->size == size &&
+            memcmp(set->members, members, size * sizeof(ushort)) == 0)
+            return set->id;
+    }
+    if (num_sets == DRTAINT_LABEL_SET_UNKNOWN)
+        return DRTAINT_LABEL_SET_UNKNOWN;
+    set = dr_global_alloc(LABEL_SET_BYTES(size));
+    set->hash = hash;
+    set->id = num_sets;
+    set->size = size;
+    memcpy(set->members, members, size * sizeof(ushort));
+    set->next = *bucket;
+    *bucket = set;
+    sets[set->id] = set;
+    num_sets++;
+    return set->id;
+}
+
+uint
+drtaint_label_create(void)
+{
+    uint id;
+
+    if (sets == NULL)
+        return 0;
+    dr_mutex_lock(table_lock);
+    if (num_sets == DRTAINT_LABEL_SET_UNKNOWN) {
+        dr_mutex_unlock(table_lock);
+        return 0;
+    }
+    /* the new set's only member is its own ID */
+    id = num_sets;
+    ushort member = (ushort)id;
+    intern_set(&member, 1);
+    dr_mutex_unlock(table_lock);
+    return id;
+}
+
+static uint
+union_slow(uint set1, uint set2)
+{
+    label_set_t *s1, *s2;
+    ushort *members;
+    uint i = 0, j = 0, size = 0, id;
+
+    dr_mutex_lock(table_lock);
+    s1 = sets[set1];
+    s2 = sets[set2];
+    if (s1 == NULL || s2 == NULL) {
+        dr_mutex_unlock(table_lock);
+        return DRTAINT_LABEL_SET_UNKNOWN;
+    }
+    members = dr_global_alloc((s1->size + s2->size) * sizeof(ushort));
+    while (i < s1->size || j < s2->size) {
+        if (j == s2->size || (i < s1->size && s1->members[i] < s2->members[j]))
+            members[size++] = s1->members[i++];
+        else if (i == s1->size || s2->members[j] < s1->members[i])
+            members[size++] = s2->members[j++];
+        else {
+            members[size++] = s1->members[i++];
+            j++;
+        }
+    }
+    id = intern_set(members, size);
+    dr_global_free(members, (s1->size + s2->size) * sizeof(ushort));
+    dr_mutex_unlock(table_lock);
+    return id;
+}
+
+uint
+drtaint_label_union(uint set1, uint set2)
+{
+    union_entry_t *entry;
+    uint key, value, claimed;
+
+    if (set1 == set2 || set2 == 0)
+        return set1;
+    if (set1 == 0)
+        return set2;
+    /* without DRTAINT_LABELS_SETS there is no table */
+    if (set1 == DRTAINT_LABEL_SET_UNKNOWN || set2 == DRTAINT_LABEL_SET_UNKNOWN ||
+        sets == NULL)
+        return DRTAINT_LABEL_SET_UNKNOWN;
+
+    key = union_key(set1, set2);
+    entry = union_entry(key);
+    if (__atomic_load_n(&entry->key, __ATOMIC_ACQUIRE) == key) {
+        value = __atomic_load_n(&entry->value, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->key, __ATOMIC_RELAXED) == key)
+            return value;
+    }
+
+    value = union_slow(set1, set2);
+    /* Skip caching if another writer holds the entry: it's only a cache. */
+    claimed = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+    if (claimed != UNION_BUSY &&
+        __atomic_compare_exchange_n(&entry->key, &claimed, UNION_BUSY, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->key, key, __ATOMIC_RELEASE);
+    }
+    return value;
+}
+
+size_t
+drtaint_label_set_members(uint set, uint *labels, size_t max)
+{
+    label_set_t *s;
+    size_t size;
+
+    if (set == 0 || set == DRTAINT_LABEL_SET_UNKNOWN || sets == NULL)
+        return 0;
+    dr_mutex_lock(table_lock);
+    s = set < num_sets ? sets[set] : NULL;
+    size = s == NULL ? 0 : s->size;
+    for (size_t i = 0; i < size && i < max; i++)
+        labels[i] = s->members[i];
+    dr_mutex_unlock(table_lock);
+    return size;
+}
@@ -0,0 +1,23 @@
+#ifndef DRTAINT_LABEL_H_
+#define DRTAINT_LABEL_H_
+
+#include "dr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The label set table used by DRTAINT_LABELS_SETS. The public interface is
+ * in drtaint.h.
+ */
+bool
+drtaint_label_init(void);
+
+void
+drtaint_label_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,431 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drsyms.h"
+#include "drtaint.h"
+#include "drtaint_profile.h"
+
+/* Costs are summed per block tag over every build of the block, whether
+ * for a fresh block, a trace or after a flush. Translations reproduce an
+ * existing build, so they aren't counted.
+ */
+typedef struct _profile_block_t {
+    struct _profile_block_t *next; /* in its hash bucket */
+    void *tag;
+    uint module; /* index into modules, or NO_MODULE */
+    size_t offs; /* from the module's start */
+    size_t func_offs; /* resolved at exit */
+    uint builds;
+    uint64 app_instrs;
+    uint64 meta_instrs;
+    uint64 spills;
+    uint64 flags_avoided;
+    uint64 flag_spills;
+    uint64 usecs;
+} profile_block_t;
+
+#define NUM_BUCKETS 4096
+#define MAX_MODULES 256
+#define NO_MODULE MAX_MODULES
+
+/* The block being built by a thread */
+typedef struct _profile_thread_t {
+    bool active;
+    uint64 start;
+    uint app_instrs;
+    uint spills;
+    uint flags_avoided;
+    uint flag_spills;
+} profile_thread_t;
+
+static uint profile_top;
+static int tls_idx;
+static void *table_lock;
+static profile_block_t **buckets;
+static uint num_blocks;
+static char *modules[MAX_MODULES];
+static uint num_modules;
+
+static dr_emit_flags_t
+event_bb_begin(void *drcontext, void *tag, instrlist_t *ilist, bool for_trace,
+               bool translating);
+
+static dr_emit_flags_t
+event_bb_end(void *drcontext, void *tag, instrlist_t *ilist, bool for_trace,
+             bool translating);
+
+static void
+event_thread_init(void *drcontext);
+
+static void
+event_thread_exit(void *drcontext);
+
+bool
+drtaint_profile_init(uint top)
+{
+    /* before and after everyone else's block events */
+    drmgr_priority_t begin_pri = { sizeof(begin_pri), "drtaint.profile.begin",
+                                   NULL, NULL, -100000 };
+    drmgr_priority_t end_pri = { sizeof(end_pri), "drtaint.profile.end",
+                                 NULL, NULL, 100000 };
+
+    if (top == 0)
+        return true;
+    profile_top = top;
+    if (drsym_init(0) != DRSYM_SUCCESS)
+        return false;
+    tls_idx = drmgr_register_tls_field();
+    if (tls_idx == -1 ||
+        !drmgr_register_thread_init_event(event_thread_init) ||
+        !drmgr_register_thread_exit_event(event_thread_exit) ||
+        !drmgr_register_bb_app2app_event(event_bb_begin, &begin_pri) ||
+        !drmgr_register_bb_instru2instru_event(event_bb_end, &end_pri))
+        return false;
+    buckets = dr_global_alloc(NUM_BUCKETS * sizeof(*buckets));
+    memset(buckets, 0, NUM_BUCKETS * sizeof(*buckets));
+    table_lock = dr_mutex_create();
+    return true;
+}
+
+static void
+event_thread_init(void *drcontext)
+{
+    profile_thread_t *pt = dr_thread_alloc(drcontext, sizeof(*pt));
+    memset(pt, 0, sizeof(*pt));
+    drmgr_set_tls_field(drcontext, tls_idx, pt);
+}
+
+static void
+event_thread_exit(void *drcontext)
+{
+    profile_thread_t *pt = drmgr_get_tls_field(drcontext, tls_idx);
+    dr_thread_free(drcontext, pt, sizeof(*pt));
+}
+
+static dr_emit_flags_t
+event_bb_begin(void *drcontext, void *tag, instrlist_t *ilist, bool for_trace,
+               bool translating)
+{
+    profile_thread_t *pt = drmgr_get_tls_field(drcontext, tls_idx);
+    instr_t *instr;
+
+    pt->active = !translating;
+    pt->app_instrs = 0;
+    pt->spills = 0;
+    pt->flags_avoided = 0;
+    pt->flag_spills = 0;
+    for (instr = instrlist_first_app(ilist); instr != NULL;
+         instr = instr_get_next_app(instr))
+        pt->app_instrs++;
+    pt->start = dr_get_microseconds();
+    return DR_EMIT_DEFAULT;
+}
+
+instr_t *
+drtaint_profile_mark(instrlist_t *ilist, instr_t *where)
+{
+    return profile_top == 0 ? NULL : instr_get_prev(where);
+}
+
+void
+drtaint_profile_count_spills(void *drcontext, instrlist_t *ilist, instr_t *mark,
+                             instr_t *where)
+{
+    profile_thread_t *pt;
+    instr_t *instr;
+
+    if (profile_top == 0)
+        return;
+    pt = drmgr_get_tls_field(drcontext, tls_idx);
+    for (instr = mark == NULL ? instrlist_first(ilist) : instr_get_next(mark);
+         instr != where && instr != NULL; instr = instr_get_next(instr))
+        pt->spills++;
+}
+
+void
+drtaint_profile_count_flags_avoided(void *drcontext)
+{
+    profile_thread_t *pt;
+
+    if (profile_top == 0)
+        return;
+    pt = drmgr_get_tls_field(drcontext, tls_idx);
+    pt->flags_avoided++;
+}
+
+void
+drtaint_profile_count_flag_spill(void *drcontext)
+{
+    profile_thread_t *pt;
+
+    if (profile_top == 0)
+        return;
+    pt = drmgr_get_tls_field(drcontext, tls_idx);
+    pt->flag_spills++;
+}
+
+/* Returns the index of the module holding pc, adding it if need be. The
+ * caller holds table_lock.
+ */
+static uint
+module_index(app_pc pc, size_t *offs)
+{
+    module_data_t *data = dr_lookup_module(pc);
+    uint i;
+
+    if (data == NULL)
+        return NO_MODULE;
+    *offs = pc - data->start;
+    for (i = 0; i < num_modules; i++) {
+        if (strcmp(modules[i], data->full_path) == 0)
+            break;
+    }
+    if (i == num_modules) {
+        if (num_modules == MAX_MODULES) {
+            dr_free_module_data(data);
+            return NO_MODULE;
+        }
+        modules[i] = dr_global_alloc(strlen(data->full_path) + 1);
+        strcpy(modules[i], data->full_path);
+        num_modules++;
+    }
+    dr_free_module_data(data);
+    return i;
+}
+
+static dr_emit_flags_t
+event_bb_end(void *drcontext, void *tag, instrlist_t *ilist, bool for_trace,
+             bool translating)
+{
+    profile_thread_t *pt = drmgr_get_tls_field(drcontext, tls_idx);
+    uint64 usecs = dr_get_microseconds() - pt->start;
+    profile_block_t **bucket = &buckets[((ptr_uint_t)tag >> 2) % NUM_BUCKETS];
+    profile_block_t *block;
+    instr_t *instr;
+    uint meta = 0;
+
+    if (!pt->active)
+        return DR_EMIT_DEFAULT;
+    pt->active = false;
+    for (instr = instrlist_first(ilist); instr != NULL; instr = instr_get_next(instr)) {
+        if (!instr_is_app(instr) && !instr_is_label(instr))
+            meta++;
+    }
+
+    dr_mutex_lock(table_lock);
+    for (block = *bucket; block != NULL; block = block->next) {
+        if (block->tag == tag)
+            break;
+    }
+    if (block == NULL) {
+        block = dr_global_alloc(sizeof(*block));
+        memset(block, 0, sizeof(*block));
+        block->tag = tag;
+        block->module = module_index(dr_fragment_app_pc(tag), &block->offs);
+        block->next = *bucket;
+        *bucket = block;
+        num_blocks++;
+    }
+    block->builds++;
+    block->app_instrs += pt->app_instrs;
+    block->meta_instrs += meta;
+    block->spills += pt->spills;
+    block->flags_avoided += pt->flags_avoided;
+    block->flag_spills += pt->flag_spills;
+    block->usecs += usecs;
+    dr_mutex_unlock(table_lock);
+    return DR_EMIT_DEFAULT;
+}
+
+/* ======================================================================================
+ * report
+ * ==================================================================================== */
+/* Costs summed over a function or a module */
+typedef struct _profile_sum_t {
+    uint module;
+    size_t func_offs;
+    uint builds;
+    uint64 app_instrs;
+    uint64 meta_instrs;
+    uint64 spills;
+    uint64 flags_avoided;
+    uint64 flag_spills;
+    uint64 usecs;
+} profile_sum_t;
+
+static int
+compare_location(const void *a, const void *b)
+{
+    const profile_block_t *b1 = *(const profile_block_t *const *)a;
+    const profile_block_t *b2 = *(const profile_block_t *const *)b;
+
+    if (b1->module != b2->module)
+        return b1->module < b2->module ? -1 : 1;
+    if (b1->func_offs != b2->func_offs)
+        return b1->func_offs < b2->func_offs ? -1 : 1;
+    return 0;
+}
+
+static int
+compare_usecs(const void *a, const void *b)
+{
+    const profile_sum_t *s1 = (const profile_sum_t *)a;
+    const profile_sum_t *s2 = (const profile_sum_t *)b;
+
+    if (s1->usecs != s2->usecs)
+        return s1->usecs > s2->usecs ? -1 : 1;
+    return 0;
+}
+
+static void
+sum_add(profile_sum_t *sum, const profile_block_t *block)
+{
+    sum->builds += block->builds;
+    sum->app_instrs += block->app_instrs;
+    sum->meta_instrs += block->meta_instrs;
+    sum->spills += block->spills;
+    sum->flags_avoided += block->flags_avoided;
+    sum->flag_spills += block->flag_spills;
+    sum->usecs += block->usecs;
+}
+
+static const char *
+module_name(uint module)
+{
+    const char *name;
+
+    if (module == NO_MODULE)
+        return "<unknown>";
+    name = strrchr(modules[module], '/');
+    return name == NULL ? modules[module] : name + 1;
+}
+
+static void
+print_sums(const char *what, profile_sum_t *sums, uint num, bool functions)
+{
+    char name[256];
+    drsym_info_t sym;
+
+    qsort(sums, num, sizeof(*sums), compare_usecs);
+    dr_fprintf(STDERR, "drtaint profile: top %u %s by instrumentation time\n",
+               profile_top, what);
+    dr_fprintf(STDERR, "%12s %8s %10s %10s %9s %10s %8s %8s  %s\n", "usecs",
+               "builds", "app", "meta", "meta/app", "spills", "no_flags", "flags",
+               what);
+    for (uint i = 0, printed = 0; i < num && printed < profile_top; i++) {
+        profile_sum_t *sum = &sums[i];
+        uint64 ratio = sum->app_instrs == 0 ? 0 :
+            sum->meta_instrs * 100 / sum->app_instrs;
+
+        if (sum->builds == 0)
+            continue;
+        printed++;
+        name[0] = '\0';
+        if (functions && sum->module != NO_MODULE) {
+            sym.struct_size = sizeof(sym);
+            sym.name = name;
+            sym.name_size = sizeof(name);
+            sym.file = NULL;
+            sym.file_size = 0;
+            if (drsym_lookup_address(modules[sum->module], sum->func_offs, &sym,
+                                     DRSYM_DEMANGLE) != DRSYM_SUCCESS)
+                dr_snprintf(name, sizeof(name), "+" PIFX, sum->func_offs);
+            NULL_TERMINATE_BUFFER(name);
+        }
+        dr_fprintf(STDERR, "%12" UINT64_FORMAT_CODE " %8u %10" UINT64_FORMAT_CODE
+                   " %10" UINT64_FORMAT_CODE " %5" UINT64_FORMAT_CODE
+                   ".%02" UINT64_FORMAT_CODE " %10" UINT64_FORMAT_CODE
+                   " %8" UINT64_FORMAT_CODE " %8" UINT64_FORMAT_CODE "  %s%s%s\n",
+                   sum->usecs, sum->builds, sum->app_instrs, sum->meta_instrs,
+                   ratio / 100, ratio % 100, sum->spills, sum->flags_avoided,
+                   sum->flag_spills,
+                   module_name(sum->module), functions ? "!" : "", name);
+    }
+}
+
+static void
+print_report(void)
+{
+    profile_block_t **blocks;
+    profile_sum_t *funcs, *mods;
+    uint num = 0, num_funcs = 0;
+    drsym_info_t sym;
+
+    if (num_blocks == 0)
+        return;
+    blocks = dr_global_alloc(num_blocks * sizeof(*blocks));
+    for (uint i = 0; i < NUM_BUCKETS; i++) {
+        for (profile_block_t *block = buckets[i]; block != NULL; block = block->next)
+            blocks[num++] = block;
+    }
+
+    /* Find each block's function, without its name, so blocks can be
+     * grouped by function before only the top functions are named.
+     */
+    for (uint i = 0; i < num; i++) {
+        profile_block_t *block = blocks[i];
+        block->func_offs = block->offs;
+        if (block->module == NO_MODULE)
+            continue;
+        sym.struct_size = sizeof(sym);
+        sym.name = NULL;
+        sym.name_size = 0;
+        sym.file = NULL;
+        sym.file_size = 0;
+        if (drsym_lookup_address(modules[block->module], block->offs, &sym,
+                                 DRSYM_DEFAULT_FLAGS) == DRSYM_SUCCESS)
+            block->func_offs = sym.start_offs;
+    }
+    qsort(blocks, num, sizeof(*blocks), compare_location);
+
+    funcs = dr_global_alloc(num * sizeof(*funcs));
+    mods = dr_global_alloc((MAX_MODULES + 1) * sizeof(*mods));
+    memset(funcs, 0, num * sizeof(*funcs));
+    memset(mods, 0, (MAX_MODULES + 1) * sizeof(*mods));
+    for (uint i = 0; i < num; i++) {
+        profile_block_t *block = blocks[i];
+        if (i == 0 || compare_location(&blocks[i - 1], &blocks[i]) != 0) {
+            funcs[num_funcs].module = block->module;
+            funcs[num_funcs].func_offs = block->func_offs;
+            num_funcs++;
+        }
+        sum_add(&funcs[num_funcs - 1], block);
+        mods[block->module].module = block->module;
+        sum_add(&mods[block->module], block);
+    }
+    print_sums("functions", funcs, num_funcs, true);
+    print_sums("modules", mods, MAX_MODULES + 1, false);
+
+    dr_global_free(mods, (MAX_MODULES + 1) * sizeof(*mods));
+    dr_global_free(funcs, num * sizeof(*funcs));
+    dr_global_free(blocks, num_blocks * sizeof(*blocks));
+}
+
+void
+drtaint_profile_exit(void)
+{
+    profile_block_t *block, *next;
+
+    if (profile_top == 0)
+        return;
+    print_report();
+    drsym_exit();
+    drmgr_unregister_bb_app2app_event(event_bb_begin);
+    drmgr_unregister_bb_instru2instru_event(event_bb_end);
+    drmgr_unregister_thread_init_event(event_thread_init);
+    drmgr_unregister_thread_exit_event(event_thread_exit);
+    drmgr_unregister_tls_field(tls_idx);
+    for (uint i = 0; i < NUM_BUCKETS; i++) {
+        for (block = buckets[i]; block != NULL; block = next) {
+            next = block->next;
+            dr_global_free(block, sizeof(*block));
+        }
+    }
+    for (uint i = 0; i < num_modules; i++)
+        dr_global_free(modules[i], strlen(modules[i]) + 1);
+    dr_global_free(buckets, NUM_BUCKETS * sizeof(*buckets));
+    dr_mutex_destroy(table_lock);
+    profile_top = 0;
+}
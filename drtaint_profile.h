@@ -0,0 +1,54 @@
+#ifndef DRTAINT_PROFILE_H_
+#define DRTAINT_PROFILE_H_
+
+#include "dr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Instrumentation cost profiling, enabled by drtaint_options_t.profile_top.
+ * For each block built we record the wall time from the first app2app
+ * event to the last instru2instru event, the meta instructions in the
+ * finished block per original app instruction, and the spills and
+ * restores drreg inserted where drtaint reserved and released registers,
+ * the flag spills avoided by choosing flag-neutral sequences and the ones
+ * drreg had to make where the flags were live. The
+ * costliest functions and modules are printed at exit.
+ */
+bool
+drtaint_profile_init(uint top);
+
+void
+drtaint_profile_exit(void);
+
+/* Returns the instruction that the instructions a reservation inserts at
+ * where will follow, to pass to drtaint_profile_count_spills().
+ */
+instr_t *
+drtaint_profile_mark(instrlist_t *ilist, instr_t *where);
+
+/* Counts the instructions inserted between mark and where as spills or
+ * restores of the block being built.
+ */
+void
+drtaint_profile_count_spills(void *drcontext, instrlist_t *ilist, instr_t *mark,
+                             instr_t *where);
+
+/* Counts a place where drtaint emitted a flag-neutral sequence instead of
+ * one that would have had drreg save the live arithmetic flags.
+ */
+void
+drtaint_profile_count_flags_avoided(void *drcontext);
+
+/* Counts a reservation of the arithmetic flags where they are live, which
+ * has drreg save and restore them.
+ */
+void
+drtaint_profile_count_flag_spill(void *drcontext);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdint.h>
+
+#include "drtaint_scan.h"
+
+/* On ARM the NEON kernels are in drtaint_scan_neon.c, which the build
+ * compiles with NEON and marks by defining DRTAINT_SCAN_NEON here. The
+ * x86 kernels need nothing beyond the compiler's target flags.
+ */
+#if defined(DRTAINT_SCAN_NEON)
+# include <sys/auxv.h>
+/* HWCAP_NEON in the ARM Linux ABI */
+# define SCAN_HWCAP_NEON (1 << 12)
+
+size_t
+drtaint_scan_first_nonzero_neon(const unsigned char *shadow, size_t size);
+
+unsigned char
+drtaint_scan_union_neon(const unsigned char *shadow, size_t size);
+#elif defined(__AVX2__)
+# include <immintrin.h>
+# define SCAN_AVX2
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+# define SCAN_SSE2
+#endif
+
+#if defined(DRTAINT_SCAN_NEON)
+/* Not every ARMv7 core has NEON. Racing threads compute the same answer. */
+static int
+scan_have_neon(void)
+{
+    static int have_neon = -1;
+
+    if (have_neon < 0)
+        have_neon = (getauxval(AT_HWCAP) & SCAN_HWCAP_NEON) != 0;
+    return have_neon;
+}
+#endif
+
+const char *
+drtaint_scan_kernel(void)
+{
+#if defined(DRTAINT_SCAN_NEON)
+    return scan_have_neon() ? "neon" : "word";
+#elif defined(SCAN_AVX2)
+    return "avx2";
+#elif defined(SCAN_SSE2)
+    return "sse2";
+#else
+    return "word";
+#endif
+}
+
+/* The vector loops only find the step holding the first nonzero byte, and
+ * leave the scalar loop to find it within the step.
+ */
+size_t
+drtaint_scan_first_nonzero(const unsigned char *shadow, size_t size)
+{
+    size_t i = 0;
+
+#if defined(DRTAINT_SCAN_NEON)
+    if (scan_have_neon())
+        return drtaint_scan_first_nonzero_neon(shadow, size);
+#endif
+#if defined(SCAN_AVX2)
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(shadow + i));
+        if (!_mm256_testz_si256(v, v))
+            break;
+    }
+#elif defined(SCAN_SSE2)
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(shadow + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff)
+            break;
+    }
+#else
+    for (; i + sizeof(uintptr_t) <= size; i += sizeof(uintptr_t)) {
+        uintptr_t word;
+        __builtin_memcpy(&word, shadow + i, sizeof(word));
+        if (word != 0)
+            break;
+    }
+#endif
+    for (; i < size && shadow[i] == 0; i++)
+        ;
+    return i;
+}
+
+unsigned char
+drtaint_scan_union(const unsigned char *shadow, size_t size)
+{
+    unsigned char label = 0;
+    size_t i = 0;
+
+#if defined(DRTAINT_SCAN_NEON)
+    if (scan_have_neon())
+        return drtaint_scan_union_neon(shadow, size);
+#endif
+#if defined(SCAN_AVX2)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 32 <= size; i += 32)
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(shadow + i)));
+    uint64_t folded[2];
+    _mm_storeu_si128((__m128i *)folded,
+                     _mm_or_si128(_mm256_castsi256_si128(acc),
+                                  _mm256_extracti128_si256(acc, 1)));
+    folded[0] |= folded[1];
+#elif defined(SCAN_SSE2)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16)
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(shadow + i)));
+    uint64_t folded[2];
+    _mm_storeu_si128((__m128i *)folded, acc);
+    folded[0] |= folded[1];
+#else
+    uintptr_t folded[1] = { 0 };
+    for (; i + sizeof(uintptr_t) <= size; i += sizeof(uintptr_t)) {
+        uintptr_t word;
+        __builtin_memcpy(&word, shadow + i, sizeof(word));
+        folded[0] |= word;
+    }
+#endif
+    for (; folded[0] != 0; folded[0] >>= 8)
+        label |= (unsigned char)folded[0];
+    for (; i < size; i++)
+        label |= shadow[i];
+    return label;
+}
@@ -0,0 +1,35 @@
+#ifndef DRTAINT_SCAN_H_
+#define DRTAINT_SCAN_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Kernels that scan a buffer of shadow bytes several bytes per step. They
+ * depend on nothing from DynamoRIO so that they can be benchmarked on
+ * their own.
+ */
+
+/* Returns the name of the kernels in use: neon, avx2, sse2, or word for the
+ * portable loops.
+ */
+const char *
+drtaint_scan_kernel(void);
+
+/* Returns the offset of the first nonzero byte of shadow[0, size), or size
+ * if there is none.
+ */
+size_t
+drtaint_scan_first_nonzero(const unsigned char *shadow, size_t size);
+
+/* Returns the bitwise OR of shadow[0, size) */
+unsigned char
+drtaint_scan_union(const unsigned char *shadow, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+#include <stdint.h>
+
+#include "drtaint_scan.h"
+
+/* The NEON kernels. This file alone is built with NEON enabled, so that
+ * the compiler can't slip NEON into code run on a CPU without it, and
+ * drtaint_scan.c only calls in here once the CPU reports NEON.
+ */
+#if !defined(__ARM_NEON) && !defined(__ARM_NEON__)
+# error "build drtaint_scan_neon.c with -mfpu=neon and a hard or softfp float ABI"
+#endif
+
+#include <arm_neon.h>
+
+size_t
+drtaint_scan_first_nonzero_neon(const unsigned char *shadow, size_t size)
+{
+    size_t i = 0;
+
+    /* find the step holding the first nonzero byte, then the byte */
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8(shadow + i);
+        uint32x2_t half = vreinterpret_u32_u8(vorr_u8(vget_low_u8(v),
+                                                      vget_high_u8(v)));
+        if ((vget_lane_u32(half, 0) | vget_lane_u32(half, 1)) != 0)
+            break;
+    }
+    for (; i < size && shadow[i] == 0; i++)
+        ;
+    return i;
+}
+
+unsigned char
+drtaint_scan_union_neon(const unsigned char *shadow, size_t size)
+{
+    uint8x16_t acc = vdupq_n_u8(0);
+    unsigned char label = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+        acc = vorrq_u8(acc, vld1q_u8(shadow + i));
+    uint8x8_t half = vorr_u8(vget_low_u8(acc), vget_high_u8(acc));
+    uint64_t folded = vget_lane_u64(vreinterpret_u64_u8(half), 0);
+    for (; folded != 0; folded >>= 8)
+        label |= (unsigned char)folded;
+    for (; i < size; i++)
+        label |= shadow[i];
+    return label;
+}
@@ -5,12 +5,60 @@
 #include "dr_api.h"
 #include "drmgr.h"
 #include "umbra.h"
+#include "drreg.h"
 #include "drtaint.h"
+#include "drtaint_scan.h"
+#include "drtaint_label.h"
+#include "drtaint_helper.h"
+#include "drtaint_shadow.h"
+#include "drtaint_stats.h"
+
+#define TESTANY(mask, var) (((mask) & (var)) != 0)
 
 static int num_shadow_count;
 static umbra_map_t *umbra_map;
 static int tls_index;
 
+/* Raw TLS slots, each reachable with a single load off the TLS base:
+ * - the per_thread_t pointer, so instrumentation avoids drmgr's extra
+ *   indirection;
+ * - a summary of the shadow registers, which is zero only if no register
+ *   is tainted, so a single memory operand can select between the clean
+ *   and instrumented copies of a block;
+ * - the app address and shadow translation cached by the leader of a group
+ *   of accesses off the same base register, with the shadow zero if the
+ *   group's span crosses a shadow block;
+ * - the result of a label set union computed out of line;
+ * - a flag set before each svc and cleared once r0's shadow has been
+ *   cleared for the syscall's result;
+ * - a flag set where excluded code returns and cleared where it calls or
+ *   jumps out, which the next included return site consumes.
+ */
+enum {
+    TLS_SLOT_SHADOW_REGS,
+    TLS_SLOT_SUMMARY,
+    TLS_SLOT_GROUP_APP,
+    TLS_SLOT_GROUP_SHADOW,
+    TLS_SLOT_UNION,
+    TLS_SLOT_SYSCALL,
+    TLS_SLOT_EXCLUDED,
+    TLS_SLOT_COUNT,
+};
+static reg_id_t tls_seg;
+static uint tls_offs;
+
+#define TLS_SLOT(slot) (tls_offs + (slot) * sizeof(void *))
+#define TLS_SLOT_VALUE(slot) \
+    (*(ptr_uint_t *)((byte *)dr_get_dr_segment_base(tls_seg) + TLS_SLOT(slot)))
+
+/* log2 of the app bytes covered by one shadow value, and by one shadow block */
+static uint app_scale_shift;
+static uint app_block_shift;
+/* log2 of the bytes in a shadow value */
+static uint label_shift;
+
+static bool record_origins;
+
 /* shadow memory */
 static reg_id_t
 get_faulting_shadow_reg(void *drcontext, dr_mcontext_t *mc);
@@ -23,7 +71,7 @@ static dr_signal_action_t
 event_signal_instrumentation(void *drcontext, dr_siginfo_t *info);
 
 static bool
-drtaint_shadow_mem_init(int id);
+drtaint_shadow_mem_init(int id, const drtaint_options_t *ops);
 
 static void
 drtaint_shadow_mem_exit(void);
@@ -41,32 +89,144 @@ event_thread_init(void *drcontext);
 static void
 event_thread_exit(void *drcontext);
 
+#define CACHE_LINE_SIZE 64
+
+/* Each thread's block gets whole cache lines to itself, so threads don't
+ * falsely share their shadow registers.
+ */
 typedef struct _per_thread_t {
-    /* Holds shadow values for general purpose registers. The shadow memory
-     * currently uses UMBRA_MAP_SCALE_DOWN_4X, which implies that each 4-byte
-     * aligned location is represented as one byte. We imitate this here.
+    /* Holds shadow values for general purpose registers, one value each
+     * whatever the memory granularity. Loads fold the shadow values of an
+     * access into its register's value, and stores spread it back out.
+     * There is room for the widest value.
      */
-    byte shadow_gprs[DR_NUM_GPR_REGS];
-} per_thread_t;
+    byte shadow_gprs[DR_NUM_GPR_REGS * sizeof(ushort)];
+    /* Nonzero if a SIMD lane may be tainted. Every lane store sets it, and
+     * the register summary at the exit of a block storing lanes rescans
+     * them, leaving the union of the lanes in it.
+     */
+    uint simd_dirty;
+    /* Holds a shadow value for each 32-bit lane of the SIMD and floating
+     * point registers.
+     */
+    byte shadow_simd[DRTAINT_SHADOW_SIMD_LANES * sizeof(ushort)];
+    /* the allocation this was aligned within */
+    void *alloc;
+    /* The next slot to write in the origin ring. The ring is aligned to
+     * twice its size, so clearing the size bit wraps a pointer off its end.
+     */
+    app_pc *origin_pos;
+    void *origin_alloc;
+    /* the thread's summary slot, so any thread can force it */
+    ptr_uint_t *summary;
+} __attribute__((aligned(CACHE_LINE_SIZE))) per_thread_t;
+
+#define ORIGIN_RING_BYTES (DRTAINT_ORIGINS_MAX * sizeof(app_pc))
+
+/* The bytes of per_thread_t from the start of shadow_gprs to the end of
+ * the SIMD lanes in use, simd_dirty included. The GPR slots are sized for
+ * the widest value, so the lanes don't start right after the GPR values in
+ * use.
+ */
+#define SHADOW_REGS_BYTES \
+    (offsetof(per_thread_t, shadow_simd) + (DRTAINT_SHADOW_SIMD_LANES << label_shift))
 
 bool
-drtaint_shadow_init(int id)
+drtaint_shadow_init(int id, const drtaint_options_t *ops)
 {
     /* XXX: we only support a single umbra mapping */
     if (dr_atomic_add32_return_sum(&num_shadow_count, 1) > 1)
         return false;
-    if (!drtaint_shadow_mem_init(id) || !drtaint_shadow_reg_init())
+    if (!drtaint_shadow_mem_init(id, ops) || !drtaint_shadow_reg_init())
+        return false;
+    if (label_shift != 0 && !drtaint_label_init())
         return false;
+    record_origins = ops->origin_mode != DRTAINT_ORIGINS_OFF;
     return true;
 }
 
+uint
+drtaint_shadow_scale(void)
+{
+    return 1 << app_scale_shift;
+}
+
+uint
+drtaint_shadow_label_size(void)
+{
+    return 1 << label_shift;
+}
+
 void
 drtaint_shadow_exit(void)
 {
+    if (label_shift != 0)
+        drtaint_label_exit();
     drtaint_shadow_mem_exit();
     drtaint_shadow_reg_exit();
 }
 
+/* x86 names the condition of a compare of equal operands after the flag */
+#ifdef X86
+# define PRED_EQ DR_PRED_Z
+#else
+# define PRED_EQ DR_PRED_EQ
+#endif
+
+/* reg as an operand accessing bytes bytes of memory: an x86 register must
+ * be the size of the memory it is loaded from or stored to.
+ */
+static opnd_t
+opnd_create_sized_reg(reg_id_t reg, uint bytes)
+{
+#ifdef X86
+    return opnd_create_reg(reg_resize_to_opsz(reg, opnd_size_from_bytes(bytes)));
+#else
+    return opnd_create_reg(reg);
+#endif
+}
+
+static void
+insert_or(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t dst,
+          reg_id_t src)
+{
+#ifdef X86
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_or
+                             (drcontext,
+                              opnd_create_reg(dst),
+                              opnd_create_reg(src)));
+#else
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_orr
+                             (drcontext,
+                              opnd_create_reg(dst),
+                              opnd_create_reg(dst),
+                              opnd_create_reg(src)));
+#endif
+}
+
+/* With 16-bit values and a word shadow, umbra maps each app byte to half a
+ * shadow byte, so we round down to the start of the word's value.
+ */
+static void
+insert_align_shadow(void *drcontext, instrlist_t *ilist, instr_t *where,
+                    reg_id_t regaddr)
+{
+    if (label_shift == 0 || app_scale_shift == 0)
+        return;
+#ifdef X86
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_and
+                             (drcontext,
+                              opnd_create_reg(regaddr),
+                              OPND_CREATE_INT8(-(1 << label_shift))));
+#else
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_bic
+                             (drcontext,
+                              opnd_create_reg(regaddr),
+                              opnd_create_reg(regaddr),
+                              OPND_CREATE_INT((1 << label_shift) - 1)));
+#endif
+}
+
 bool
 drtaint_shadow_insert_app_to_shadow(void *drcontext, instrlist_t *ilist, instr_t *where,
                                     reg_id_t regaddr, reg_id_t scratch)
@@ -79,40 +239,620 @@ drtaint_shadow_insert_app_to_shadow(void *drcontext, instrlist_t *ilist, instr_t
     if (umbra_insert_app_to_shadow(drcontext, umbra_map, ilist, where, regaddr,
                                    &scratch, 1) != DRMF_SUCCESS)
         return false;
+    insert_align_shadow(drcontext, ilist, where, regaddr);
+    return true;
+}
+
+#ifndef X86
+/* Only the ARM handlers group accesses. */
+static void
+insert_add_disp(void *drcontext, instrlist_t *ilist, instr_t *where,
+                reg_id_t dst, reg_id_t src, int disp)
+{
+    if (disp >= 0) {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_add
+                                 (drcontext,
+                                  opnd_create_reg(dst),
+                                  opnd_create_reg(src),
+                                  OPND_CREATE_INT(disp)));
+    } else {
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_sub
+                                 (drcontext,
+                                  opnd_create_reg(dst),
+                                  opnd_create_reg(src),
+                                  OPND_CREATE_INT(-disp)));
+    }
+}
+
+bool
+drtaint_shadow_insert_app_to_shadow_leader(void *drcontext, instrlist_t *ilist,
+                                           instr_t *where, reg_id_t regaddr,
+                                           int lo, int hi, reg_id_t scratch1,
+                                           reg_id_t scratch2)
+{
+    /* scratch1 = (regaddr + lo ^ regaddr + hi) >> app_block_shift */
+    insert_add_disp(drcontext, ilist, where, scratch1, regaddr, lo);
+    insert_add_disp(drcontext, ilist, where, scratch2, regaddr, hi);
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_eor
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch2)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lsr
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch1),
+                              OPND_CREATE_INT(app_block_shift)));
+    dr_insert_write_raw_tls(drcontext, ilist, where, tls_seg,
+                            TLS_SLOT(TLS_SLOT_GROUP_APP), regaddr);
+    if (!drtaint_shadow_insert_app_to_shadow(drcontext, ilist, where, regaddr,
+                                             scratch2))
+        return false;
+
+    /* Turn scratch1 into an all-ones mask if the span stays in one block
+     * and zero otherwise, without touching the flags: clz gives 32 only
+     * for zero.
+     */
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_clz
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch1)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lsr
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch1),
+                              OPND_CREATE_INT(5)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_rsb
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch1),
+                              OPND_CREATE_INT(0)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_and
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(regaddr)));
+    dr_insert_write_raw_tls(drcontext, ilist, where, tls_seg,
+                            TLS_SLOT(TLS_SLOT_GROUP_SHADOW), scratch1);
+    return true;
+}
+
+bool
+drtaint_shadow_insert_app_to_shadow_member(void *drcontext, instrlist_t *ilist,
+                                           instr_t *where, reg_id_t regaddr,
+                                           int delta, reg_id_t scratch)
+{
+    instr_t *slow = INSTR_CREATE_label(drcontext);
+    instr_t *done = INSTR_CREATE_label(drcontext);
+
+    /* The app address is saved on both paths: a write through the cached
+     * translation can fault on a shared block just like any other.
+     */
+    dr_save_reg(drcontext, ilist, where, regaddr, SPILL_SLOT_2);
+    dr_insert_read_raw_tls(drcontext, ilist, where, tls_seg,
+                           TLS_SLOT(TLS_SLOT_GROUP_SHADOW), scratch);
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_cmp
+                             (drcontext,
+                              opnd_create_reg(scratch),
+                              OPND_CREATE_INT(0)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump_cond
+                             (drcontext, DR_PRED_EQ,
+                              opnd_create_instr(slow)));
+    insert_add_disp(drcontext, ilist, where, regaddr, scratch, delta);
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump
+                             (drcontext, opnd_create_instr(done)));
+    instrlist_meta_preinsert(ilist, where, slow);
+    if (umbra_insert_app_to_shadow(drcontext, umbra_map, ilist, where, regaddr,
+                                   &scratch, 1) != DRMF_SUCCESS)
+        return false;
+    insert_align_shadow(drcontext, ilist, where, regaddr);
+    instrlist_meta_preinsert(ilist, where, done);
     return true;
 }
 
+static void
+insert_orr_shifted(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t reg,
+                   dr_shift_type_t shift, uint amount)
+{
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_orr_shimm
+                             (drcontext,
+                              opnd_create_reg(reg),
+                              opnd_create_reg(reg),
+                              opnd_create_reg(reg),
+                              OPND_CREATE_INT(shift),
+                              OPND_CREATE_INT(amount)));
+}
+#endif
+
+/* Repeats the label in value's low amount bits over the next amount bits,
+ * which must be clear.
+ */
+static void
+insert_spread(void *drcontext, instrlist_t *ilist, instr_t *where, reg_id_t value,
+              uint amount)
+{
+#ifdef X86
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_imul_imm
+                             (drcontext,
+                              opnd_create_sized_reg(value, 4),
+                              opnd_create_sized_reg(value, 4),
+                              OPND_CREATE_INT32(1 + (1 << amount))));
+#else
+    insert_orr_shifted(drcontext, ilist, where, value, DR_SHIFT_LSL, amount);
+#endif
+}
+
+static void
+union_callout(uint set1, uint set2)
+{
+    drtaint_stats_callout(DRTAINT_STATS_CALLOUT_UNION);
+    TLS_SLOT_VALUE(TLS_SLOT_UNION) = drtaint_label_union(set1, set2);
+}
+
+static void
+load_union_callout(ushort *shadow, uint count)
+{
+    uint set = shadow[0];
+    drtaint_stats_callout(DRTAINT_STATS_CALLOUT_UNION);
+    for (uint i = 1; i < count; i++)
+        set = drtaint_label_union(set, shadow[i]);
+    TLS_SLOT_VALUE(TLS_SLOT_UNION) = set;
+}
+
 bool
-drtaint_shadow_get_app_taint(void *drcontext, app_pc app, byte *result)
+drtaint_shadow_insert_union(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            reg_id_t dst, reg_id_t src)
 {
-    size_t sz = 1;
-    bool ret = umbra_read_shadow_memory(umbra_map, app, 4,
-                                        &sz, result) != DRMF_ERROR_INVALID_ADDRESS;
+    instr_t *take_src, *done;
+
+    if (label_shift == 0) {
+        insert_or(drcontext, ilist, where, dst, src);
+        return true;
+    }
+
+    /* Only a union of two distinct nonempty sets leaves the code cache */
+    take_src = INSTR_CREATE_label(drcontext);
+    done = INSTR_CREATE_label(drcontext);
+#ifndef X86
+    if (!drtaint_reserve_aflags(drcontext, ilist, where, true))
+        return false;
+#endif
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_cmp
+                             (drcontext,
+                              opnd_create_reg(src),
+                              OPND_CREATE_INT32(0)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump_cond
+                             (drcontext, PRED_EQ,
+                              opnd_create_instr(done)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_cmp
+                             (drcontext,
+                              opnd_create_reg(dst),
+                              OPND_CREATE_INT32(0)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump_cond
+                             (drcontext, PRED_EQ,
+                              opnd_create_instr(take_src)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_cmp
+                             (drcontext,
+                              opnd_create_reg(dst),
+                              opnd_create_reg(src)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump_cond
+                             (drcontext, PRED_EQ,
+                              opnd_create_instr(done)));
+    dr_insert_clean_call(drcontext, ilist, where, (void *)union_callout, false, 2,
+                         opnd_create_reg(dst), opnd_create_reg(src));
+    dr_insert_read_raw_tls(drcontext, ilist, where, tls_seg,
+                           TLS_SLOT(TLS_SLOT_UNION), dst);
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump
+                             (drcontext, opnd_create_instr(done)));
+    instrlist_meta_preinsert(ilist, where, take_src);
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_move
+                             (drcontext,
+                              opnd_create_reg(dst),
+                              opnd_create_reg(src)));
+    instrlist_meta_preinsert(ilist, where, done);
+#ifndef X86
+    if (!drtaint_unreserve_aflags(drcontext, ilist, where))
+        return false;
+#endif
+    return true;
+}
+
+bool
+drtaint_shadow_insert_load_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                 reg_id_t regaddr, reg_id_t dst, uint size)
+{
+    /* With a word shadow, one shadow value covers any access of up to a
+     * word. With a byte shadow we load all of the access's shadow values
+     * at once and fold them together: bit labels with orr, and label sets
+     * out of line.
+     */
+    if (app_scale_shift != 0 || size == 1) {
+        if (label_shift == 0) {
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_1byte
+                                     (drcontext,
+                                      opnd_create_reg(dst),
+                                      OPND_CREATE_MEM8(regaddr, 0)));
+        } else {
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_2bytes
+                                     (drcontext,
+                                      opnd_create_reg(dst),
+                                      OPND_CREATE_MEM16(regaddr, 0)));
+        }
+    } else if (label_shift != 0) {
+        dr_insert_clean_call(drcontext, ilist, where, (void *)load_union_callout,
+                             false, 2, opnd_create_reg(regaddr),
+                             OPND_CREATE_INT32(size));
+        dr_insert_read_raw_tls(drcontext, ilist, where, tls_seg,
+                               TLS_SLOT(TLS_SLOT_UNION), dst);
+    } else {
+#ifdef X86
+        /* x86 can or each further byte's label straight from memory */
+        DR_ASSERT(size <= 4);
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_1byte
+                                 (drcontext,
+                                  opnd_create_reg(dst),
+                                  OPND_CREATE_MEM8(regaddr, 0)));
+        for (uint i = 1; i < size; i++) {
+            instrlist_meta_preinsert(ilist, where, INSTR_CREATE_or
+                                     (drcontext,
+                                      opnd_create_sized_reg(dst, 1),
+                                      OPND_CREATE_MEM8(regaddr, i)));
+        }
+#else
+        if (size == 2) {
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_2bytes
+                                     (drcontext,
+                                      opnd_create_reg(dst),
+                                      OPND_CREATE_MEM16(regaddr, 0)));
+            insert_orr_shifted(drcontext, ilist, where, dst, DR_SHIFT_LSR, 8);
+        } else {
+            DR_ASSERT(size == 4);
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_load
+                                     (drcontext,
+                                      opnd_create_reg(dst),
+                                      OPND_CREATE_MEM32(regaddr, 0)));
+            insert_orr_shifted(drcontext, ilist, where, dst, DR_SHIFT_LSR, 16);
+            insert_orr_shifted(drcontext, ilist, where, dst, DR_SHIFT_LSR, 8);
+        }
+#endif
+    }
+    return true;
+}
+
+bool
+drtaint_shadow_insert_store_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                  app_pc xl8, reg_id_t regaddr, reg_id_t value,
+                                  uint size)
+{
+    instr_t *store;
+    uint bytes = (app_scale_shift != 0 ? 1 : size) << label_shift;
+
+    /* value holds a single label, which we repeat over each shadow value */
+    if (bytes == 1) {
+        store = XINST_CREATE_store_1byte(drcontext,
+                                         OPND_CREATE_MEM8(regaddr, 0),
+                                         opnd_create_sized_reg(value, 1));
+    } else if (bytes == 2) {
+        if (label_shift == 0)
+            insert_spread(drcontext, ilist, where, value, 8);
+        store = XINST_CREATE_store_2bytes(drcontext,
+                                          OPND_CREATE_MEM16(regaddr, 0),
+                                          opnd_create_sized_reg(value, 2));
+    } else {
+        if (label_shift == 0)
+            insert_spread(drcontext, ilist, where, value, 8);
+        insert_spread(drcontext, ilist, where, value, 16);
+        if (bytes == 8) {
+            /* four label sets take two words */
+            store = XINST_CREATE_store(drcontext,
+                                       OPND_CREATE_MEM32(regaddr, 4),
+                                       opnd_create_sized_reg(value, 4));
+            instrlist_meta_preinsert(ilist, where, INSTR_XL8(store, xl8));
+        }
+        DR_ASSERT(bytes == 4 || bytes == 8);
+        store = XINST_CREATE_store(drcontext,
+                                   OPND_CREATE_MEM32(regaddr, 0),
+                                   opnd_create_sized_reg(value, 4));
+    }
+    instrlist_meta_preinsert(ilist, where, INSTR_XL8(store, xl8));
+    return true;
+}
+
+bool
+drtaint_shadow_get_app_taint(void *drcontext, app_pc app, uint *result)
+{
+    size_t sz = 1 << label_shift;
+    ushort value = 0;
+    bool ret = umbra_read_shadow_memory(umbra_map,
+                                        (app_pc)ALIGN_BACKWARD(app, drtaint_shadow_scale()),
+                                        drtaint_shadow_scale(), &sz,
+                                        (byte *)&value) != DRMF_ERROR_INVALID_ADDRESS;
+    *result = value;
     return ret;
 }
 
 bool
-drtaint_shadow_set_app_taint(void *drcontext, app_pc app, byte result)
+drtaint_shadow_set_app_taint(void *drcontext, app_pc app, uint result)
 {
-    size_t sz = 1;
-    bool ret = umbra_write_shadow_memory(umbra_map, app, 4,
-                                         &sz, &result) != DRMF_ERROR_INVALID_ADDRESS;
+    size_t sz = 1 << label_shift;
+    ushort value = (ushort)result;
+    bool ret = umbra_write_shadow_memory(umbra_map,
+                                         (app_pc)ALIGN_BACKWARD(app, drtaint_shadow_scale()),
+                                         drtaint_shadow_scale(), &sz,
+                                         (byte *)&value) != DRMF_ERROR_INVALID_ADDRESS;
     return ret;
 }
 
+/* the number of shadow values covering [app, app + size) */
+#define SHADOW_SIZE(app, size)                                  \
+    ((((ptr_uint_t)(app) + (size) - 1) >> app_scale_shift) -    \
+     ((ptr_uint_t)(app) >> app_scale_shift) + 1)
+
+/* Calls cb on each piece of [start, start + size) that lies in one shadow
+ * block, with the piece's shadow or NULL if the block is the shared
+ * default. The shadow of start may cover app bytes before it. Stops early
+ * if cb returns false.
+ */
+static bool
+shadow_iterate_app_range(app_pc start, size_t size,
+                         bool (*cb)(app_pc app, size_t size, byte *shadow,
+                                    void *user_data),
+                         void *user_data)
+{
+    umbra_shadow_memory_info_t info;
+    byte *shadow;
+    app_pc app = start;
+    app_pc end = start + size;
+
+    while (app < end) {
+        info.struct_size = sizeof(info);
+        if (umbra_get_shadow_memory(umbra_map, app, &shadow, &info) != DRMF_SUCCESS)
+            return false;
+        app_pc block_end = info.app_base + info.app_size;
+        app_pc piece_end = (block_end <= app || block_end > end) ? end : block_end;
+        if (TESTANY(UMBRA_SHADOW_MEMORY_TYPE_SHARED, info.shadow_type))
+            shadow = NULL;
+        if (!cb(app, piece_end - app, shadow, user_data))
+            break;
+        if (piece_end <= app)
+            break; /* the block ends the address space */
+        app = piece_end;
+    }
+    return true;
+}
+
+typedef struct _range_read_t {
+    app_pc start;
+    byte *result;
+} range_read_t;
+
+static bool
+get_range_cb(app_pc app, size_t size, byte *shadow, void *user_data)
+{
+    range_read_t *read = (range_read_t *)user_data;
+    byte *result = read->result + (app - read->start);
+    size_t i;
+
+    if (shadow == NULL) {
+        memset(result, 0, size);
+        return true;
+    }
+    for (i = 0; i < size; i++) {
+        result[i] = shadow[(((ptr_uint_t)app + i) >> app_scale_shift) -
+                           ((ptr_uint_t)app >> app_scale_shift)];
+    }
+    return true;
+}
+
+bool
+drtaint_shadow_get_app_taint_range(void *drcontext, app_pc start, size_t size,
+                                   byte *result)
+{
+    range_read_t read = { start, result };
+    if (label_shift != 0)
+        return false;
+    return shadow_iterate_app_range(start, size, get_range_cb, &read);
+}
+
+typedef struct _range_find_t {
+    app_pc first;
+    uint label;
+} range_find_t;
+
+static bool
+find_tainted_cb(app_pc app, size_t size, byte *shadow, void *user_data)
+{
+    range_find_t *find = (range_find_t *)user_data;
+    size_t shadow_size, i;
+
+    if (shadow == NULL)
+        return true; /* the shared default block is clean */
+    shadow_size = SHADOW_SIZE(app, size) << label_shift;
+    i = drtaint_scan_first_nonzero(shadow, shadow_size);
+    if (i == shadow_size)
+        return true;
+    i >>= label_shift;
+    find->label = label_shift == 0 ? shadow[i] : ((ushort *)shadow)[i];
+    find->first = (app_pc)((((ptr_uint_t)app >> app_scale_shift) + i) <<
+                           app_scale_shift);
+    if (find->first < app)
+        find->first = app;
+    return false;
+}
+
+bool
+drtaint_shadow_find_tainted(void *drcontext, app_pc start, size_t size, bool *found,
+                            app_pc *first_tainted, uint *label)
+{
+    range_find_t find = { NULL, 0 };
+
+    if (!shadow_iterate_app_range(start, size, find_tainted_cb, &find))
+        return false;
+    *found = find.first != NULL;
+    if (!*found)
+        return true;
+    if (first_tainted != NULL)
+        *first_tainted = find.first;
+    if (label != NULL)
+        *label = find.label;
+    return true;
+}
+
+static bool
+union_cb(app_pc app, size_t size, byte *shadow, void *user_data)
+{
+    if (shadow != NULL)
+        *(byte *)user_data |= drtaint_scan_union(shadow, SHADOW_SIZE(app, size));
+    return true;
+}
+
+bool
+drtaint_shadow_get_app_taint_union(void *drcontext, app_pc start, size_t size,
+                                   byte *label)
+{
+    if (label_shift != 0)
+        return false;
+    *label = 0;
+    return shadow_iterate_app_range(start, size, union_cb, label);
+}
+
+/* Sets the shadow of [start, start + size) to value. Blocks still the
+ * shared default need no clearing. With free_blocks, blocks wholly inside
+ * the range go back to umbra, which maps them to the shared default again.
+ * That is only safe once no thread can be accessing the block's app
+ * memory, so it is left to munmap: instrumentation that already
+ * translated an address would otherwise write through a freed block.
+ */
+static bool
+shadow_set_app_range(app_pc start, size_t size, uint value, bool free_blocks)
+{
+    umbra_shadow_memory_info_t info;
+    byte *shadow;
+    size_t shadow_size;
+    /* cover every shadow byte that the range touches */
+    app_pc app = (app_pc)ALIGN_BACKWARD(start, drtaint_shadow_scale());
+    app_pc end = (app_pc)ALIGN_FORWARD(start + size, drtaint_shadow_scale());
+
+    while (app < end) {
+        info.struct_size = sizeof(info);
+        if (umbra_get_shadow_memory(umbra_map, app, &shadow, &info) != DRMF_SUCCESS)
+            return false;
+        app_pc block_end = info.app_base + info.app_size;
+        app_pc piece_end = (block_end <= app || block_end > end) ? end : block_end;
+        bool shared = TESTANY(UMBRA_SHADOW_MEMORY_TYPE_SHARED, info.shadow_type);
+
+        if (value == 0 && shared) {
+            /* the shared default block is already clean */
+        } else if (free_blocks && app == info.app_base && piece_end == block_end) {
+            if (umbra_delete_shadow_memory(umbra_map, app, info.app_size) !=
+                DRMF_SUCCESS)
+                return false;
+        } else {
+            if (shared &&
+                umbra_replace_shared_shadow_memory(umbra_map, app,
+                                                   &shadow) != DRMF_SUCCESS)
+                return false;
+            if (label_shift == 0 || value == 0) {
+                if (umbra_shadow_set_range(umbra_map, app, piece_end - app,
+                                           &shadow_size, value, 1) != DRMF_SUCCESS)
+                    return false;
+            } else {
+                for (size_t i = 0; i < SHADOW_SIZE(app, piece_end - app); i++)
+                    ((ushort *)shadow)[i] = (ushort)value;
+            }
+        }
+        if (piece_end <= app)
+            break; /* the block ends the address space */
+        app = piece_end;
+    }
+    return true;
+}
+
+bool
+drtaint_shadow_set_app_taint_range(void *drcontext, app_pc start, size_t size,
+                                   uint value)
+{
+    return shadow_set_app_range(start, size, value, false);
+}
+
+bool
+drtaint_shadow_free_app_range(void *drcontext, app_pc start, size_t size)
+{
+    return shadow_set_app_range(start, size, 0, true);
+}
+
+static bool
+shadow_usage_cb(umbra_map_t *map, const umbra_shadow_memory_info_t *info,
+                void *user_data)
+{
+    if (!TESTANY(UMBRA_SHADOW_MEMORY_TYPE_SHARED, info->shadow_type))
+        *(size_t *)user_data += info->shadow_size;
+    return true;
+}
+
+bool
+drtaint_shadow_get_usage(size_t *bytes)
+{
+    *bytes = 0;
+    return umbra_iterate_shadow_memory(umbra_map, bytes,
+                                       shadow_usage_cb) == DRMF_SUCCESS;
+}
+
+/* Ranges beyond this are likely reservations that are mostly never written,
+ * so we leave them to the fault path.
+ */
+#define EAGER_ALLOC_MAX (64 * 1024 * 1024)
+
+bool
+drtaint_shadow_alloc_app_range(void *drcontext, app_pc start, size_t size)
+{
+    umbra_shadow_memory_info_t info;
+    byte *shadow;
+    app_pc app = start;
+
+    if (size > EAGER_ALLOC_MAX)
+        return true;
+    /* Give each shared shadow block under the range its own memory now,
+     * rather than taking a fault on the first write to each one.
+     */
+    while (app < start + size) {
+        info.struct_size = sizeof(info);
+        if (umbra_get_shadow_memory(umbra_map, app, &shadow, &info) != DRMF_SUCCESS)
+            return false;
+        if (TESTANY(UMBRA_SHADOW_MEMORY_TYPE_SHARED, info.shadow_type) &&
+            umbra_replace_shared_shadow_memory(umbra_map, app,
+                                               &shadow) != DRMF_SUCCESS)
+            return false;
+        if (info.app_base + info.app_size <= app)
+            break; /* the block ends the address space */
+        app = info.app_base + info.app_size;
+    }
+    return true;
+}
+
 /* ======================================================================================
  * shadow memory implementation
  * ==================================================================================== */
 static bool
-drtaint_shadow_mem_init(int id)
+drtaint_shadow_mem_init(int id, const drtaint_options_t *ops)
 {
     umbra_map_options_t umbra_map_ops;
+    size_t block_size;
 
     drmgr_init();
 
     /* initialize umbra and lazy page handling */
     memset(&umbra_map_ops, 0, sizeof(umbra_map_ops));
-    umbra_map_ops.scale              = UMBRA_MAP_SCALE_DOWN_4X;
+    label_shift = ops->label_mode == DRTAINT_LABELS_SETS ? 1 : 0;
+    if (ops->granularity == DRTAINT_GRANULARITY_BYTE) {
+        umbra_map_ops.scale = label_shift == 0 ? UMBRA_MAP_SCALE_SAME_1X :
+            UMBRA_MAP_SCALE_UP_2X;
+        app_scale_shift = 0;
+    } else {
+        umbra_map_ops.scale = label_shift == 0 ? UMBRA_MAP_SCALE_DOWN_4X :
+            UMBRA_MAP_SCALE_DOWN_2X;
+        app_scale_shift = 2;
+    }
     umbra_map_ops.flags              = UMBRA_MAP_CREATE_SHADOW_ON_TOUCH |
                                        UMBRA_MAP_SHADOW_SHARED_READONLY;
     umbra_map_ops.default_value      = 0;
@@ -122,6 +862,12 @@ drtaint_shadow_mem_init(int id)
         return false;
     if (umbra_create_mapping(&umbra_map_ops, &umbra_map) != DRMF_SUCCESS)
         return false;
+    if (umbra_get_shadow_block_size(umbra_map, &block_size) != DRMF_SUCCESS)
+        return false;
+    for (app_block_shift = app_scale_shift;
+         ((size_t)1 << app_block_shift) < (block_size << app_scale_shift) >> label_shift;
+         app_block_shift++)
+        ;
     drmgr_register_signal_event(event_signal_instrumentation);
     return true;
 }
@@ -157,7 +903,7 @@ handle_special_shadow_fault(void *drcontext, dr_mcontext_t *raw_mc,
                             app_pc app_shadow)
 {
     umbra_shadow_memory_type_t shadow_type;
-    app_pc app_target;
+    app_pc app_target, group_app;
     reg_id_t reg;
 
     /* If a fault occured, it is probably because we computed the
@@ -185,6 +931,19 @@ handle_special_shadow_fault(void *drcontext, dr_mcontext_t *raw_mc,
         DR_ASSERT(false);
         return true;
     }
+    app_shadow = (app_pc)ALIGN_BACKWARD(app_shadow, 1 << label_shift);
+
+    /* A group leader's cached translation may point into the block we
+     * just replaced, so move it along to the new block.
+     */
+    group_app = (app_pc)TLS_SLOT_VALUE(TLS_SLOT_GROUP_APP);
+    if (TLS_SLOT_VALUE(TLS_SLOT_GROUP_SHADOW) != 0 &&
+        ((ptr_uint_t)group_app >> app_block_shift) ==
+        ((ptr_uint_t)app_target >> app_block_shift)) {
+        TLS_SLOT_VALUE(TLS_SLOT_GROUP_SHADOW) = (ptr_uint_t)app_shadow +
+            (((ptr_int_t)((ptr_uint_t)group_app >> app_scale_shift) -
+              (ptr_int_t)((ptr_uint_t)app_target >> app_scale_shift)) << label_shift);
+    }
 
     /* Replace the faulting register value to reflect the new shadow
      * memory.
@@ -226,61 +985,612 @@ drtaint_shadow_reg_init(void)
     tls_index = drmgr_register_tls_field();
     if (tls_index == -1)
         return false;
+    if (!dr_raw_tls_calloc(&tls_seg, &tls_offs, TLS_SLOT_COUNT, 0))
+        return false;
     return true;
 }
 
+/* Returns the index of reg's shadow value among the general purpose
+ * registers, or -1 if it has none. This and per_thread_t are all the
+ * shadow register layout knows of the ISA: a partial register, which
+ * only the x86 ISAs have, shares its full register's value.
+ */
+static int
+shadow_gpr_index(reg_id_t reg)
+{
+#ifdef X86
+    reg = reg_to_pointer_sized(reg);
+#endif
+    if (reg < DR_REG_START_GPR || reg > DR_REG_STOP_GPR)
+        return -1;
+    return reg - DR_REG_START_GPR;
+}
+
+static unsigned int
+shadow_reg_offs(reg_id_t shadow)
+{
+    int index = shadow_gpr_index(shadow);
+
+    DR_ASSERT(index >= 0);
+    return offsetof(per_thread_t, shadow_gprs) + (index << label_shift);
+}
+
+uint
+drtaint_shadow_simd_lanes(reg_id_t reg, uint *first)
+{
+#ifdef X86
+    if (reg >= DR_REG_XMM0 && reg <= DR_REG_XMM15) {
+        *first = (reg - DR_REG_XMM0) * 4;
+        return 4;
+    }
+    if (reg >= DR_REG_YMM0 && reg <= DR_REG_YMM15) {
+        *first = (reg - DR_REG_YMM0) * 4;
+        return 4;
+    }
+    return 0;
+#else
+    if (reg >= DR_REG_Q0 && reg <= DR_REG_Q15) {
+        *first = (reg - DR_REG_Q0) * 4;
+        return 4;
+    }
+    if (reg >= DR_REG_D0 && reg <= DR_REG_D31) {
+        *first = (reg - DR_REG_D0) * 2;
+        return 2;
+    }
+    if (reg >= DR_REG_S0 && reg <= DR_REG_S31) {
+        *first = reg - DR_REG_S0;
+        return 1;
+    }
+    return 0;
+#endif
+}
+
+static unsigned int
+shadow_simd_offs(uint lane)
+{
+    DR_ASSERT(lane < DRTAINT_SHADOW_SIMD_LANES);
+    return offsetof(per_thread_t, shadow_simd) + (lane << label_shift);
+}
+
 bool
-drtaint_shadow_insert_reg_to_shadow(void *drcontext, instrlist_t *ilist, instr_t *where,
-                                    reg_id_t shadow,  reg_id_t regaddr)
+drtaint_shadow_insert_reg_base(void *drcontext, instrlist_t *ilist, instr_t *where,
+                               reg_id_t base)
 {
-    unsigned int offs = offsetof(per_thread_t, shadow_gprs[shadow - DR_REG_R0]);
-    DR_ASSERT(shadow - DR_REG_R0 < DR_NUM_GPR_REGS);
     /* Load the per_thread data structure holding the thread-local taint
      * values of each register.
      */
-    drmgr_insert_read_tls_field(drcontext, tls_index, ilist, where, regaddr);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_add
+    dr_insert_read_raw_tls(drcontext, ilist, where, tls_seg,
+                           TLS_SLOT(TLS_SLOT_SHADOW_REGS), base);
+    return true;
+}
+
+bool
+drtaint_shadow_insert_reg_to_shadow_ex(void *drcontext, instrlist_t *ilist,
+                                       instr_t *where, reg_id_t shadow, reg_id_t base,
+                                       reg_id_t regaddr)
+{
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_add_2src
                              (drcontext,
                               opnd_create_reg(regaddr),
-                              OPND_CREATE_INT8(offs)));
+                              opnd_create_reg(base),
+                              OPND_CREATE_INT8(shadow_reg_offs(shadow))));
     return true;
 }
 
+bool
+drtaint_shadow_insert_reg_to_shadow_load_ex(void *drcontext, instrlist_t *ilist,
+                                            instr_t *where, reg_id_t shadow,
+                                            reg_id_t base, reg_id_t result)
+{
+    if (label_shift == 0) {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_1byte
+                                 (drcontext,
+                                  opnd_create_reg(result),
+                                  OPND_CREATE_MEM8(base, shadow_reg_offs(shadow))));
+    } else {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_2bytes
+                                 (drcontext,
+                                  opnd_create_reg(result),
+                                  OPND_CREATE_MEM16(base, shadow_reg_offs(shadow))));
+    }
+    return true;
+}
+
+bool
+drtaint_shadow_insert_reg_to_shadow_store_ex(void *drcontext, instrlist_t *ilist,
+                                             instr_t *where, reg_id_t shadow,
+                                             reg_id_t base, reg_id_t value)
+{
+    if (label_shift == 0) {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
+                                 (drcontext,
+                                  OPND_CREATE_MEM8(base, shadow_reg_offs(shadow)),
+                                  opnd_create_sized_reg(value, 1)));
+    } else {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_2bytes
+                                 (drcontext,
+                                  OPND_CREATE_MEM16(base, shadow_reg_offs(shadow)),
+                                  opnd_create_sized_reg(value, 2)));
+    }
+    return true;
+}
+
+bool
+drtaint_shadow_insert_simd_to_shadow_load_ex(void *drcontext, instrlist_t *ilist,
+                                             instr_t *where, uint lane, reg_id_t base,
+                                             reg_id_t result)
+{
+    if (label_shift == 0) {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_1byte
+                                 (drcontext,
+                                  opnd_create_reg(result),
+                                  OPND_CREATE_MEM8(base, shadow_simd_offs(lane))));
+    } else {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_2bytes
+                                 (drcontext,
+                                  opnd_create_reg(result),
+                                  OPND_CREATE_MEM16(base, shadow_simd_offs(lane))));
+    }
+    return true;
+}
+
+bool
+drtaint_shadow_insert_simd_to_shadow_store_ex(void *drcontext, instrlist_t *ilist,
+                                              instr_t *where, uint lane, reg_id_t base,
+                                              reg_id_t value)
+{
+#ifdef X86
+    /* x86 marks the lanes dirty with an immediate */
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store
+                             (drcontext,
+                              OPND_CREATE_MEM32(base, offsetof(per_thread_t,
+                                                               simd_dirty)),
+                              OPND_CREATE_INT32(1)));
+#else
+    /* the base is never zero, so it marks the lanes dirty without a scratch */
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store
+                             (drcontext,
+                              OPND_CREATE_MEM32(base, offsetof(per_thread_t,
+                                                               simd_dirty)),
+                              opnd_create_reg(base)));
+#endif
+    if (label_shift == 0) {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_1byte
+                                 (drcontext,
+                                  OPND_CREATE_MEM8(base, shadow_simd_offs(lane)),
+                                  opnd_create_sized_reg(value, 1)));
+    } else {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_store_2bytes
+                                 (drcontext,
+                                  OPND_CREATE_MEM16(base, shadow_simd_offs(lane)),
+                                  opnd_create_sized_reg(value, 2)));
+    }
+    return true;
+}
+
+bool
+drtaint_shadow_insert_reg_to_shadow(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                    reg_id_t shadow,  reg_id_t regaddr)
+{
+    drtaint_shadow_insert_reg_base(drcontext, ilist, where, regaddr);
+    return drtaint_shadow_insert_reg_to_shadow_ex(drcontext, ilist, where, shadow,
+                                                  regaddr, regaddr);
+}
+
 bool
 drtaint_shadow_insert_reg_to_shadow_load(void *drcontext, instrlist_t *ilist,
                                          instr_t *where, reg_id_t shadow,
                                          reg_id_t regaddr)
 {
-    unsigned int offs = offsetof(per_thread_t, shadow_gprs[shadow - DR_REG_R0]);
-    DR_ASSERT(shadow - DR_REG_R0 < DR_NUM_GPR_REGS);
-    /* Load the per_thread data structure holding the thread-local taint
-     * values of each register.
+    drtaint_shadow_insert_reg_base(drcontext, ilist, where, regaddr);
+    return drtaint_shadow_insert_reg_to_shadow_load_ex(drcontext, ilist, where, shadow,
+                                                       regaddr, regaddr);
+}
+
+/* The registers a callee may clobber: under AAPCS r0-r3, r12, lr, d0-d7 and
+ * d16-d31, and under the x86-64 SysV ABI rax, rcx, rdx, rsi, rdi, r8-r11
+ * and every xmm register. Each lane range is a half-open [first, end).
+ */
+static const reg_id_t caller_saved_gprs[] = {
+#ifdef X86
+    DR_REG_XAX, DR_REG_XCX, DR_REG_XDX, DR_REG_XSI, DR_REG_XDI,
+    DR_REG_R8, DR_REG_R9, DR_REG_R10, DR_REG_R11,
+#else
+    DR_REG_R0, DR_REG_R1, DR_REG_R2, DR_REG_R3, DR_REG_R12, DR_REG_LR,
+#endif
+};
+
+static const uint caller_saved_lanes[][2] = {
+#ifdef X86
+    { 0, DRTAINT_SHADOW_SIMD_LANES },
+#else
+    { 0, 16 },
+    { 32, DRTAINT_SHADOW_SIMD_LANES },
+#endif
+};
+
+bool
+drtaint_shadow_insert_clear_caller_saved(void *drcontext, instrlist_t *ilist,
+                                         instr_t *where, reg_id_t base,
+                                         reg_id_t scratch)
+{
+    unsigned int offs;
+
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_int
+                             (drcontext,
+                              opnd_create_reg(scratch),
+                              OPND_CREATE_INT32(0)));
+    for (uint i = 0; i < BUFFER_SIZE_ELEMENTS(caller_saved_gprs); i++) {
+        drtaint_shadow_insert_reg_to_shadow_store_ex(drcontext, ilist, where,
+                                                     caller_saved_gprs[i], base,
+                                                     scratch);
+    }
+    /* each range of lanes is a whole number of words */
+    for (uint i = 0; i < BUFFER_SIZE_ELEMENTS(caller_saved_lanes); i++) {
+        for (offs = offsetof(per_thread_t, shadow_simd) +
+                 (caller_saved_lanes[i][0] << label_shift);
+             offs < offsetof(per_thread_t, shadow_simd) +
+                 (caller_saved_lanes[i][1] << label_shift);
+             offs += 4) {
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_store
+                                     (drcontext,
+                                      OPND_CREATE_MEM32(base, offs),
+                                      opnd_create_sized_reg(scratch, 4)));
+        }
+    }
+    return true;
+}
+
+opnd_t
+drtaint_shadow_reg_summary_opnd(void *drcontext)
+{
+    return dr_raw_tls_opnd(drcontext, tls_seg, TLS_SLOT(TLS_SLOT_SUMMARY));
+}
+
+bool
+drtaint_shadow_insert_reg_summary_set(void *drcontext, instrlist_t *ilist,
+                                      instr_t *where, reg_id_t base)
+{
+    /* the base is never zero */
+    dr_insert_write_raw_tls(drcontext, ilist, where, tls_seg,
+                            TLS_SLOT(TLS_SLOT_SUMMARY), base);
+    return true;
+}
+
+bool
+drtaint_shadow_insert_reg_summary(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                  reg_id_t base, reg_id_t scratch1, reg_id_t scratch2,
+                                  bool rescan_simd)
+{
+    int dirty = offsetof(per_thread_t, simd_dirty);
+    unsigned int offs;
+
+    /* Or the shadow GPRs together a word at a time, along with the SIMD
+     * lanes' union. Only blocks storing lanes rescan them.
      */
-    drmgr_insert_read_tls_field(drcontext, tls_index, ilist, where, regaddr);
-    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_1byte
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load
                              (drcontext,
-                              opnd_create_reg(regaddr),
-                              OPND_CREATE_MEM8(regaddr, offs)));
+                              opnd_create_sized_reg(scratch1, 4),
+                              OPND_CREATE_MEM32(base, rescan_simd ?
+                                                offsetof(per_thread_t, shadow_simd) :
+                                                dirty)));
+    if (rescan_simd) {
+        for (offs = offsetof(per_thread_t, shadow_simd) + 4; offs < SHADOW_REGS_BYTES;
+             offs += 4) {
+            instrlist_meta_preinsert(ilist, where, XINST_CREATE_load
+                                     (drcontext,
+                                      opnd_create_sized_reg(scratch2, 4),
+                                      OPND_CREATE_MEM32(base, offs)));
+            insert_or(drcontext, ilist, where, scratch1, scratch2);
+        }
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_store
+                                 (drcontext,
+                                  OPND_CREATE_MEM32(base, dirty),
+                                  opnd_create_sized_reg(scratch1, 4)));
+    }
+    for (offs = offsetof(per_thread_t, shadow_gprs);
+         offs < offsetof(per_thread_t, shadow_gprs) + (DR_NUM_GPR_REGS << label_shift);
+         offs += 4) {
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_load
+                                 (drcontext,
+                                  opnd_create_sized_reg(scratch2, 4),
+                                  OPND_CREATE_MEM32(base, offs)));
+        insert_or(drcontext, ilist, where, scratch1, scratch2);
+    }
+    dr_insert_write_raw_tls(drcontext, ilist, where, tls_seg,
+                            TLS_SLOT(TLS_SLOT_SUMMARY), scratch1);
     return true;
 }
 
 bool
-drtaint_shadow_get_reg_taint(void *drcontext, reg_id_t reg, byte *result)
+drtaint_shadow_insert_syscall_pending(void *drcontext, instrlist_t *ilist,
+                                      instr_t *where, reg_id_t scratch)
+{
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_int
+                             (drcontext,
+                              opnd_create_reg(scratch),
+                              OPND_CREATE_INT32(1)));
+    dr_insert_write_raw_tls(drcontext, ilist, where, tls_seg,
+                            TLS_SLOT(TLS_SLOT_SYSCALL), scratch);
+    return true;
+}
+
+bool
+drtaint_shadow_insert_syscall_return(void *drcontext, instrlist_t *ilist,
+                                     instr_t *where, reg_id_t base, reg_id_t scratch1,
+                                     reg_id_t scratch2)
+{
+    if (base != DR_REG_NULL) {
+        /* Without touching the flags on ARM: the flag minus one is a mask of
+         * zero if a syscall is pending, and of all ones if not.
+         */
+        dr_insert_read_raw_tls(drcontext, ilist, where, tls_seg,
+                               TLS_SLOT(TLS_SLOT_SYSCALL), scratch2);
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_sub
+                                 (drcontext,
+                                  opnd_create_reg(scratch2),
+                                  OPND_CREATE_INT32(1)));
+        drtaint_shadow_insert_reg_to_shadow_load_ex(drcontext, ilist, where,
+                                                    DRTAINT_SHADOW_SYSCALL_RESULT,
+                                                    base, scratch1);
+#ifdef X86
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_and
+                                 (drcontext,
+                                  opnd_create_reg(scratch1),
+                                  opnd_create_reg(scratch2)));
+#else
+        instrlist_meta_preinsert(ilist, where, INSTR_CREATE_and
+                                 (drcontext,
+                                  opnd_create_reg(scratch1),
+                                  opnd_create_reg(scratch1),
+                                  opnd_create_reg(scratch2)));
+#endif
+        drtaint_shadow_insert_reg_to_shadow_store_ex(drcontext, ilist, where,
+                                                     DRTAINT_SHADOW_SYSCALL_RESULT,
+                                                     base, scratch1);
+    }
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_int
+                             (drcontext,
+                              opnd_create_reg(scratch2),
+                              OPND_CREATE_INT32(0)));
+    dr_insert_write_raw_tls(drcontext, ilist, where, tls_seg,
+                            TLS_SLOT(TLS_SLOT_SYSCALL), scratch2);
+    return true;
+}
+
+void
+drtaint_shadow_syscall_returned(void *drcontext)
+{
+    /* the raw tls slot is only reachable from the owning thread */
+    DR_ASSERT(drcontext == dr_get_current_drcontext());
+    if (TLS_SLOT_VALUE(TLS_SLOT_SYSCALL) == 0)
+        return;
+    drtaint_shadow_set_reg_taint(drcontext, DRTAINT_SHADOW_SYSCALL_RESULT, 0);
+    TLS_SLOT_VALUE(TLS_SLOT_SYSCALL) = 0;
+}
+
+bool
+drtaint_shadow_insert_excluded_exit(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                    bool returning, reg_id_t scratch)
+{
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load_int
+                             (drcontext,
+                              opnd_create_reg(scratch),
+                              OPND_CREATE_INT32(returning ? 1 : 0)));
+    dr_insert_write_raw_tls(drcontext, ilist, where, tls_seg,
+                            TLS_SLOT(TLS_SLOT_EXCLUDED), scratch);
+    return true;
+}
+
+bool
+drtaint_shadow_insert_excluded_return(void *drcontext, instrlist_t *ilist,
+                                      instr_t *where, reg_id_t base, reg_id_t scratch)
+{
+    instr_t *done = INSTR_CREATE_label(drcontext);
+
+    if (base == DR_REG_NULL)
+        return drtaint_shadow_insert_excluded_exit(drcontext, ilist, where, false,
+                                                   scratch);
+    dr_insert_read_raw_tls(drcontext, ilist, where, tls_seg,
+                           TLS_SLOT(TLS_SLOT_EXCLUDED), scratch);
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_cmp
+                             (drcontext,
+                              opnd_create_reg(scratch),
+                              OPND_CREATE_INT32(0)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump_cond
+                             (drcontext, PRED_EQ,
+                              opnd_create_instr(done)));
+    /* this leaves scratch zero, which also clears the flag */
+    drtaint_shadow_insert_clear_caller_saved(drcontext, ilist, where, base, scratch);
+    dr_insert_write_raw_tls(drcontext, ilist, where, tls_seg,
+                            TLS_SLOT(TLS_SLOT_EXCLUDED), scratch);
+    instrlist_meta_preinsert(ilist, where, done);
+    return true;
+}
+
+bool
+drtaint_shadow_insert_record_origin(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                    reg_id_t base, app_pc pc, reg_id_t value,
+                                    reg_id_t scratch1, reg_id_t scratch2)
+{
+    int offs = offsetof(per_thread_t, origin_pos);
+
+    /* pc always goes into the next slot, but the position only moves past
+     * it if value is nonzero.
+     */
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              OPND_CREATE_MEMPTR(base, offs)));
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)pc,
+                                     opnd_create_reg(scratch2), ilist, where,
+                                     NULL, NULL);
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store
+                             (drcontext,
+                              OPND_CREATE_MEMPTR(scratch1, 0),
+                              opnd_create_reg(scratch2)));
+#ifdef X86
+    instr_t *skip = INSTR_CREATE_label(drcontext);
+
+    /* x86 has no clz, but holds the flags here anyway */
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_cmp
+                             (drcontext,
+                              opnd_create_reg(value),
+                              OPND_CREATE_INT32(0)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_jump_cond
+                             (drcontext, PRED_EQ,
+                              opnd_create_instr(skip)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_add
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              OPND_CREATE_INT32(sizeof(app_pc))));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_and
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              OPND_CREATE_INT32(~(int)ORIGIN_RING_BYTES)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store
+                             (drcontext,
+                              OPND_CREATE_MEMPTR(base, offs),
+                              opnd_create_reg(scratch1)));
+    instrlist_meta_preinsert(ilist, where, skip);
+#else
+    /* Without touching the flags: clz gives 32 only for zero. */
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_clz
+                             (drcontext,
+                              opnd_create_reg(scratch2),
+                              opnd_create_reg(value)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lsr
+                             (drcontext,
+                              opnd_create_reg(scratch2),
+                              opnd_create_reg(scratch2),
+                              OPND_CREATE_INT(5)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_rsb
+                             (drcontext,
+                              opnd_create_reg(scratch2),
+                              opnd_create_reg(scratch2),
+                              OPND_CREATE_INT(1)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_lsl
+                             (drcontext,
+                              opnd_create_reg(scratch2),
+                              opnd_create_reg(scratch2),
+                              OPND_CREATE_INT(2)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_add
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch2)));
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_bic
+                             (drcontext,
+                              opnd_create_reg(scratch1),
+                              opnd_create_reg(scratch1),
+                              OPND_CREATE_INT(ORIGIN_RING_BYTES)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store
+                             (drcontext,
+                              OPND_CREATE_MEMPTR(base, offs),
+                              opnd_create_reg(scratch1)));
+#endif
+    return true;
+}
+
+size_t
+drtaint_shadow_get_origins(void *drcontext, app_pc *pcs, size_t max)
+{
+    per_thread_t *data = drmgr_get_tls_field(drcontext, tls_index);
+    app_pc *ring, *pos;
+    size_t i, n;
+
+    if (data->origin_pos == NULL)
+        return 0;
+    ring = (app_pc *)ALIGN_BACKWARD(data->origin_pos, ORIGIN_RING_BYTES);
+    pos = data->origin_pos;
+    /* the slot at origin_pos holds the last pc that stored a zero value */
+    for (i = 0, n = 0; n < max && i < DRTAINT_ORIGINS_MAX - 1; i++) {
+        pos = pos == ring ? ring + DRTAINT_ORIGINS_MAX - 1 : pos - 1;
+        if (*pos == NULL)
+            break; /* the ring hasn't filled yet */
+        /* an instruction storing several tainted values records each */
+        if (n > 0 && pcs[n - 1] == *pos)
+            continue;
+        pcs[n++] = *pos;
+    }
+    return n;
+}
+
+void
+drtaint_shadow_force_reg_summary(void *drcontext)
 {
     per_thread_t *data = drmgr_get_tls_field(drcontext, tls_index);
-    if (reg - DR_REG_R0 >= DR_NUM_GPR_REGS)
+
+    /* Only the exit of an instrumented block recomputes the summary, so it
+     * stays on until one runs.
+     */
+    *data->summary = 1;
+}
+
+static uint
+simd_lane_label(per_thread_t *data, uint lane)
+{
+    if (label_shift == 0)
+        return data->shadow_simd[lane];
+    return ((ushort *)data->shadow_simd)[lane];
+}
+
+bool
+drtaint_shadow_get_reg_taint(void *drcontext, reg_id_t reg, uint *result)
+{
+    per_thread_t *data = drmgr_get_tls_field(drcontext, tls_index);
+    uint first, num = drtaint_shadow_simd_lanes(reg, &first);
+    int index;
+
+    if (num != 0) {
+        /* a multi-lane register's shadow is the union of its lanes */
+        *result = simd_lane_label(data, first);
+        for (uint i = 1; i < num; i++) {
+            uint label = simd_lane_label(data, first + i);
+            *result = label_shift == 0 ? *result | label :
+                drtaint_label_union(*result, label);
+        }
+        return true;
+    }
+    index = shadow_gpr_index(reg);
+    if (index < 0)
         return false;
-    *result = data->shadow_gprs[reg - DR_REG_R0];
+    if (label_shift == 0)
+        *result = data->shadow_gprs[index];
+    else
+        *result = ((ushort *)data->shadow_gprs)[index];
     return true;
 }
 
 bool
-drtaint_shadow_set_reg_taint(void *drcontext, reg_id_t reg, byte value)
+drtaint_shadow_set_reg_taint(void *drcontext, reg_id_t reg, uint value)
 {
     per_thread_t *data = drmgr_get_tls_field(drcontext, tls_index);
-    if (reg - DR_REG_R0 >= DR_NUM_GPR_REGS)
+    uint first, num = drtaint_shadow_simd_lanes(reg, &first);
+    int index;
+
+    if (num != 0) {
+        for (uint i = first; i < first + num; i++) {
+            if (label_shift == 0)
+                data->shadow_simd[i] = (byte)value;
+            else
+                ((ushort *)data->shadow_simd)[i] = (ushort)value;
+        }
+        if (value != 0) {
+            data->simd_dirty = 1;
+            drtaint_shadow_force_reg_summary(drcontext);
+        }
+        return true;
+    }
+    index = shadow_gpr_index(reg);
+    if (index < 0)
         return false;
-    data->shadow_gprs[reg - DR_REG_R0] = value;
+    if (label_shift == 0)
+        data->shadow_gprs[index] = (byte)value;
+    else
+        ((ushort *)data->shadow_gprs)[index] = (ushort)value;
+    if (value != 0)
+        drtaint_shadow_force_reg_summary(drcontext);
     return true;
 }
 
@@ -288,22 +1598,57 @@ static void
 drtaint_shadow_reg_exit(void)
 {
     drmgr_unregister_tls_field(tls_index);
+    dr_raw_tls_cfree(tls_offs, TLS_SLOT_COUNT);
     drmgr_unregister_thread_init_event(event_thread_init);
     drmgr_unregister_thread_exit_event(event_thread_exit);
     drmgr_exit();
 }
 
+#define STACK_GROWTH_WINDOW (128 * 1024)
+
 static void
 event_thread_init(void *drcontext)
 {
-    per_thread_t *data = dr_thread_alloc(drcontext, sizeof(per_thread_t));
+    dr_mcontext_t mc = { sizeof(mc), DR_MC_CONTROL };
+    dr_mem_info_t info;
+    void *alloc = dr_thread_alloc(drcontext, sizeof(per_thread_t) + CACHE_LINE_SIZE);
+    per_thread_t *data = (per_thread_t *)ALIGN_FORWARD(alloc, CACHE_LINE_SIZE);
+
     memset(data, 0, sizeof(per_thread_t));
+    data->alloc = alloc;
+    if (record_origins) {
+        data->origin_alloc = dr_thread_alloc(drcontext, 3 * ORIGIN_RING_BYTES);
+        data->origin_pos = (app_pc *)ALIGN_FORWARD(data->origin_alloc,
+                                                   2 * ORIGIN_RING_BYTES);
+        memset(data->origin_pos, 0, ORIGIN_RING_BYTES);
+    }
+    /* The drmgr field serves lookups by drcontext, while instrumentation
+     * reads the raw slot.
+     */
     drmgr_set_tls_field(drcontext, tls_index, data);
+    *(per_thread_t **)((byte *)dr_get_dr_segment_base(tls_seg) +
+                       TLS_SLOT(TLS_SLOT_SHADOW_REGS)) = data;
+    data->summary = (ptr_uint_t *)((byte *)dr_get_dr_segment_base(tls_seg) +
+                                   TLS_SLOT(TLS_SLOT_SUMMARY));
+
+    /* The stack is written right away and grows on demand without any
+     * syscall we could see, so we shadow its mapping and some room below.
+     */
+    if (dr_get_mcontext(drcontext, &mc) &&
+        dr_query_memory_ex((byte *)mc.sp, &info) &&
+        info.type != DR_MEMTYPE_FREE) {
+        app_pc low = info.base_pc >= (app_pc)STACK_GROWTH_WINDOW ?
+            info.base_pc - STACK_GROWTH_WINDOW : NULL;
+        drtaint_shadow_alloc_app_range(drcontext, low,
+                                       info.base_pc + info.size - low);
+    }
 }
 
 static void
 event_thread_exit(void *drcontext)
 {
     per_thread_t *data = drmgr_get_tls_field(drcontext, tls_index);
-    dr_thread_free(drcontext, data, sizeof(per_thread_t));
+    if (data->origin_alloc != NULL)
+        dr_thread_free(drcontext, data->origin_alloc, 3 * ORIGIN_RING_BYTES);
+    dr_thread_free(drcontext, data->alloc, sizeof(per_thread_t) + CACHE_LINE_SIZE);
 }
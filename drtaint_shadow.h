@@ -2,21 +2,52 @@
 #define SHADOW_H_
 
 #include "dr_api.h"
+#include "drtaint.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 bool
-drtaint_shadow_init(int id);
+drtaint_shadow_init(int id, const drtaint_options_t *ops);
+
+/* the number of app bytes covered by each shadow value */
+uint
+drtaint_shadow_scale(void);
+
+/* the number of bytes in each shadow value */
+uint
+drtaint_shadow_label_size(void);
 
 void
 drtaint_shadow_exit(void);
 
+/* On x86 translating an app address clobbers the arithmetic flags, as do
+ * the sequences below that leave them alone on ARM, so x86 callers hold the
+ * flags around all of them.
+ */
 bool
 drtaint_shadow_insert_app_to_shadow(void *drcontext, instrlist_t *ilist, instr_t *where,
                                     reg_id_t regaddr, reg_id_t scratch);
 
+/* Accesses off the same unmodified base register can share one translation.
+ * The leader translates regaddr in place and caches it for the members,
+ * provided [regaddr + lo, regaddr + hi] lies within one shadow block. A
+ * member translates regaddr as the leader's shadow plus delta shadow bytes,
+ * falling back to a full translation if the leader's span crossed a block.
+ * Members use the arithmetic flags, which the caller must reserve.
+ */
+bool
+drtaint_shadow_insert_app_to_shadow_leader(void *drcontext, instrlist_t *ilist,
+                                           instr_t *where, reg_id_t regaddr,
+                                           int lo, int hi, reg_id_t scratch1,
+                                           reg_id_t scratch2);
+
+bool
+drtaint_shadow_insert_app_to_shadow_member(void *drcontext, instrlist_t *ilist,
+                                           instr_t *where, reg_id_t regaddr,
+                                           int delta, reg_id_t scratch);
+
 bool
 drtaint_shadow_insert_reg_to_shadow(void *drcontext, instrlist_t *ilist, instr_t *where,
                                     reg_id_t shadow,  reg_id_t regaddr);
@@ -26,17 +57,198 @@ drtaint_shadow_insert_reg_to_shadow_load(void *drcontext, instrlist_t *ilist,
                                          instr_t *where, reg_id_t shadow,
                                          reg_id_t regaddr);
 
+/* Loads the taint of an app access of size bytes (at most a word), whose
+ * shadow address is in regaddr, into dst as a single label. The store
+ * writes the label in value, clobbering it, over the access's shadow.
+ */
+bool
+drtaint_shadow_insert_load_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                 reg_id_t regaddr, reg_id_t dst, uint size);
+
+bool
+drtaint_shadow_insert_store_taint(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                  app_pc xl8, reg_id_t regaddr, reg_id_t value,
+                                  uint size);
+
+/* Combines the label in src into dst. Label sets need the flags, which
+ * on ARM must not be reserved by the caller.
+ */
+bool
+drtaint_shadow_insert_union(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            reg_id_t dst, reg_id_t src);
+
+/* The _ex variants take the per_thread_t base, loaded once with
+ * drtaint_shadow_insert_reg_base, instead of reading it from TLS each time.
+ */
+bool
+drtaint_shadow_insert_reg_base(void *drcontext, instrlist_t *ilist, instr_t *where,
+                               reg_id_t base);
+
+bool
+drtaint_shadow_insert_reg_to_shadow_ex(void *drcontext, instrlist_t *ilist,
+                                       instr_t *where, reg_id_t shadow, reg_id_t base,
+                                       reg_id_t regaddr);
+
 bool
-drtaint_shadow_get_reg_taint(void *drcontext, reg_id_t reg, byte *result);
+drtaint_shadow_insert_reg_to_shadow_load_ex(void *drcontext, instrlist_t *ilist,
+                                            instr_t *where, reg_id_t shadow,
+                                            reg_id_t base, reg_id_t result);
 
 bool
-drtaint_shadow_set_reg_taint(void *drcontext, reg_id_t reg, byte value);
+drtaint_shadow_insert_reg_to_shadow_store_ex(void *drcontext, instrlist_t *ilist,
+                                             instr_t *where, reg_id_t shadow,
+                                             reg_id_t base, reg_id_t value);
+
+/* SIMD and floating point registers are shadowed a 32-bit lane at a time:
+ * s<n> is lane n, d<n> lanes 2n and 2n+1, and q<n> lanes 4n to 4n+3. On
+ * x86, xmm<n> is lanes 4n to 4n+3, which also cover the upper half of
+ * ymm<n>.
+ */
+#define DRTAINT_SHADOW_SIMD_LANES 64
+
+/* Returns the number of lanes in reg and sets first to the lowest, or
+ * returns 0 if reg is not a SIMD register.
+ */
+uint
+drtaint_shadow_simd_lanes(reg_id_t reg, uint *first);
+
+bool
+drtaint_shadow_insert_simd_to_shadow_load_ex(void *drcontext, instrlist_t *ilist,
+                                             instr_t *where, uint lane, reg_id_t base,
+                                             reg_id_t result);
+
+bool
+drtaint_shadow_insert_simd_to_shadow_store_ex(void *drcontext, instrlist_t *ilist,
+                                              instr_t *where, uint lane, reg_id_t base,
+                                              reg_id_t value);
+
+/* Clears the shadow of the registers a callee may clobber under the
+ * platform's calling convention, see DRTAINT_EXCLUDED_CLEAR, leaving scratch
+ * zero.
+ */
+bool
+drtaint_shadow_insert_clear_caller_saved(void *drcontext, instrlist_t *ilist,
+                                         instr_t *where, reg_id_t base,
+                                         reg_id_t scratch);
+
+opnd_t
+drtaint_shadow_reg_summary_opnd(void *drcontext);
+
+/* Sets the register summary nonzero for the duration of an instrumented
+ * block, which may taint registers before it reaches its exit.
+ */
+bool
+drtaint_shadow_insert_reg_summary_set(void *drcontext, instrlist_t *ilist,
+                                      instr_t *where, reg_id_t base);
+
+/* Computes the register summary, which is nonzero if any register may be
+ * tainted, at the exit of an instrumented block. The SIMD lanes are only
+ * rescanned if rescan_simd is set. On x86 this uses the arithmetic flags,
+ * which the caller must reserve.
+ */
+bool
+drtaint_shadow_insert_reg_summary(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                  reg_id_t base, reg_id_t scratch1, reg_id_t scratch2,
+                                  bool rescan_simd);
+
+/* Sets the register summary nonzero until an instrumented block's exit
+ * recomputes it.
+ */
+void
+drtaint_shadow_force_reg_summary(void *drcontext);
+
+bool
+drtaint_shadow_get_reg_taint(void *drcontext, reg_id_t reg, uint *result);
+
+bool
+drtaint_shadow_set_reg_taint(void *drcontext, reg_id_t reg, uint value);
+
+bool
+drtaint_shadow_get_app_taint(void *drcontext, app_pc app, uint *result);
+
+bool
+drtaint_shadow_set_app_taint(void *drcontext, app_pc app, uint result);
+
+bool
+drtaint_shadow_get_app_taint_range(void *drcontext, app_pc start, size_t size,
+                                   byte *result);
+
+bool
+drtaint_shadow_get_app_taint_union(void *drcontext, app_pc start, size_t size,
+                                   byte *label);
+
+bool
+drtaint_shadow_find_tainted(void *drcontext, app_pc start, size_t size, bool *found,
+                            app_pc *first_tainted, uint *label);
+
+bool
+drtaint_shadow_set_app_taint_range(void *drcontext, app_pc start, size_t size,
+                                   uint value);
+
+/* Clears the shadow of an app range that was just unmapped, giving the
+ * shadow blocks wholly inside it back to umbra.
+ */
+bool
+drtaint_shadow_free_app_range(void *drcontext, app_pc start, size_t size);
+
+/* the register the kernel writes a syscall's result to */
+#define DRTAINT_SHADOW_SYSCALL_RESULT IF_X86_ELSE(DR_REG_XAX, DR_REG_R0)
+
+/* The kernel overwrites r0 with a syscall's result, but pre-syscall
+ * handlers must still see the argument's taint, so r0's shadow is cleared
+ * where the syscall returns instead. The pending mark is set before the
+ * svc. Where execution resumes after it, the return sequence clears r0's
+ * shadow if the mark is set, flag-neutrally on ARM, and then the mark;
+ * with a NULL base it only clears the mark. x86 does the same for rax
+ * around syscall. For a syscall that is intercepted,
+ * drtaint_shadow_syscall_returned does the same from the post-syscall
+ * event, so that later post-syscall handlers can taint the result.
+ */
+bool
+drtaint_shadow_insert_syscall_pending(void *drcontext, instrlist_t *ilist,
+                                      instr_t *where, reg_id_t scratch);
+
+bool
+drtaint_shadow_insert_syscall_return(void *drcontext, instrlist_t *ilist,
+                                     instr_t *where, reg_id_t base, reg_id_t scratch1,
+                                     reg_id_t scratch2);
+
+void
+drtaint_shadow_syscall_returned(void *drcontext);
+
+/* Excluded code marks each exit that returns, and unmarks each that calls
+ * or jumps into included code. At a return site in included code, the
+ * return sequence clears the shadow of the caller-saved registers if the
+ * mark is set, and then the mark; with a NULL base it only clears the mark.
+ * It uses the arithmetic flags, which the caller must reserve.
+ */
+bool
+drtaint_shadow_insert_excluded_exit(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                    bool returning, reg_id_t scratch);
+
+bool
+drtaint_shadow_insert_excluded_return(void *drcontext, instrlist_t *ilist,
+                                      instr_t *where, reg_id_t base, reg_id_t scratch);
+
+/* Appends pc to the thread's origin ring, whose position is held off the
+ * per_thread_t base, if the shadow value in value is nonzero. On ARM the
+ * flags are left alone.
+ */
+bool
+drtaint_shadow_insert_record_origin(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                    reg_id_t base, app_pc pc, reg_id_t value,
+                                    reg_id_t scratch1, reg_id_t scratch2);
+
+size_t
+drtaint_shadow_get_origins(void *drcontext, app_pc *pcs, size_t max);
 
+/* the bytes of shadow memory not shared between blocks */
 bool
-drtaint_shadow_get_app_taint(void *drcontext, app_pc app, byte *result);
+drtaint_shadow_get_usage(size_t *bytes);
 
+/* Allocates non-shared shadow memory for an app range about to be written. */
 bool
-drtaint_shadow_set_app_taint(void *drcontext, app_pc app, byte result);
+drtaint_shadow_alloc_app_range(void *drcontext, app_pc start, size_t size);
 
 #ifdef __cplusplus
 }
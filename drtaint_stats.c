@@ -0,0 +1,340 @@
+#include <string.h>
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drtaint_stats.h"
+
+/* Each block's counters live for the whole run, keyed by tag, so a block
+ * that is rebuilt, or re-instrumented while translating, increments the
+ * same counters. The code cache is shared, so each thread increments its
+ * own counters, at the block's index in a per-thread array, and they are
+ * added into the block's totals when the thread exits. A per-thread
+ * counter wraps after 2^32 executions of one copy of a block.
+ */
+struct _drtaint_stats_block_t {
+    struct _drtaint_stats_block_t *next; /* in its hash bucket */
+    void *tag;
+    /* where the block's counters are in each thread's array */
+    uint index;
+    /* executions of the clean and the tainted copy, from exited threads */
+    uint64 execs[2];
+    uint num_instrs;
+    ushort opcodes[];
+};
+
+#define BLOCK_BYTES(num) (sizeof(drtaint_stats_block_t) + (num) * sizeof(ushort))
+
+#define NUM_BUCKETS 4096
+
+/* Blocks past this many are not counted. Each thread reserves a counter
+ * pair for every block, but the pages are only backed once written.
+ */
+#define MAX_COUNTED 65536
+#define COUNTS_BYTES (MAX_COUNTED * 2 * sizeof(uint))
+
+/* per-opcode flags */
+enum {
+    OPCODE_UNIMPLEMENTED = 0x1,
+    OPCODE_SIMD          = 0x2,
+};
+
+static char stats_buf[MAXIMUM_PATH];
+static const char *stats_path;
+static drtaint_stats_block_t **buckets;
+static void *table_lock;
+static uint num_blocks;
+static int tls_idx = -1;
+static int *static_counts;
+static byte *opcode_flags;
+static int callouts[DRTAINT_STATS_CALLOUT_COUNT];
+
+static const char *const callout_names[DRTAINT_STATS_CALLOUT_COUNT] = {
+    "bail",
+    "union",
+};
+
+static void
+event_thread_init(void *drcontext);
+
+static void
+event_thread_exit(void *drcontext);
+
+bool
+drtaint_stats_init(const char *path)
+{
+    if (path == NULL)
+        return true;
+    tls_idx = drmgr_register_tls_field();
+    if (tls_idx == -1 ||
+        !drmgr_register_thread_init_event(event_thread_init) ||
+        !drmgr_register_thread_exit_event(event_thread_exit))
+        return false;
+    /* every thread's counters must be merged before the report */
+    dr_request_synchronized_exit();
+    dr_snprintf(stats_buf, BUFFER_SIZE_ELEMENTS(stats_buf), "%s", path);
+    NULL_TERMINATE_BUFFER(stats_buf);
+    stats_path = stats_buf;
+    buckets = dr_global_alloc(NUM_BUCKETS * sizeof(*buckets));
+    static_counts = dr_global_alloc(OP_LAST * sizeof(*static_counts));
+    opcode_flags = dr_global_alloc(OP_LAST * sizeof(*opcode_flags));
+    table_lock = dr_mutex_create();
+    memset(buckets, 0, NUM_BUCKETS * sizeof(*buckets));
+    memset(static_counts, 0, OP_LAST * sizeof(*static_counts));
+    memset(opcode_flags, 0, OP_LAST * sizeof(*opcode_flags));
+    return true;
+}
+
+static void
+event_thread_init(void *drcontext)
+{
+    uint *counts = dr_raw_mem_alloc(COUNTS_BYTES, DR_MEMPROT_READ | DR_MEMPROT_WRITE,
+                                    NULL);
+    DR_ASSERT(counts != NULL);
+    drmgr_set_tls_field(drcontext, tls_idx, counts);
+}
+
+static void
+event_thread_exit(void *drcontext)
+{
+    uint *counts = drmgr_get_tls_field(drcontext, tls_idx);
+    drtaint_stats_block_t *block;
+
+    dr_mutex_lock(table_lock);
+    for (uint i = 0; i < NUM_BUCKETS; i++) {
+        for (block = buckets[i]; block != NULL; block = block->next) {
+            if (block->index < MAX_COUNTED) {
+                block->execs[0] += counts[2 * block->index];
+                block->execs[1] += counts[2 * block->index + 1];
+            }
+        }
+    }
+    dr_mutex_unlock(table_lock);
+    dr_raw_mem_free(counts, COUNTS_BYTES);
+}
+
+bool
+drtaint_stats_enabled(void)
+{
+    return stats_path != NULL;
+}
+
+/* The caller holds table_lock */
+static drtaint_stats_block_t *
+block_lookup(void *tag)
+{
+    drtaint_stats_block_t *block;
+
+    for (block = buckets[((ptr_uint_t)tag >> 2) % NUM_BUCKETS]; block != NULL;
+         block = block->next) {
+        if (block->tag == tag)
+            return block;
+    }
+    return NULL;
+}
+
+drtaint_stats_block_t *
+drtaint_stats_lookup(void *tag)
+{
+    drtaint_stats_block_t *block;
+
+    dr_mutex_lock(table_lock);
+    block = block_lookup(tag);
+    dr_mutex_unlock(table_lock);
+    return block;
+}
+
+drtaint_stats_block_t *
+drtaint_stats_block(void *tag, instrlist_t *ilist)
+{
+    drtaint_stats_block_t **bucket =
+        &buckets[((ptr_uint_t)tag >> 2) % NUM_BUCKETS];
+    drtaint_stats_block_t *block;
+    instr_t *instr;
+    uint num = 0;
+
+    dr_mutex_lock(table_lock);
+    block = block_lookup(tag);
+    if (block != NULL) {
+        dr_mutex_unlock(table_lock);
+        return block;
+    }
+    for (instr = instrlist_first_app(ilist); instr != NULL;
+         instr = instr_get_next_app(instr))
+        num++;
+    block = dr_global_alloc(BLOCK_BYTES(num));
+    block->tag = tag;
+    block->index = num_blocks;
+    block->execs[0] = 0;
+    block->execs[1] = 0;
+    block->num_instrs = 0;
+    for (instr = instrlist_first_app(ilist); instr != NULL;
+         instr = instr_get_next_app(instr))
+        block->opcodes[block->num_instrs++] = (ushort)instr_get_opcode(instr);
+    block->next = *bucket;
+    *bucket = block;
+    num_blocks++;
+    dr_mutex_unlock(table_lock);
+    return block;
+}
+
+void
+drtaint_stats_insert_block_count(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                 drtaint_stats_block_t *block, uintptr_t encoding,
+                                 reg_id_t scratch1, reg_id_t scratch2)
+{
+    int offs = (2 * block->index + (encoding != 0)) * sizeof(uint);
+
+    if (block->index >= MAX_COUNTED)
+        return;
+    drmgr_insert_read_tls_field(drcontext, tls_idx, ilist, where, scratch1);
+#ifdef X86
+    /* x86 increments memory directly */
+    instrlist_meta_preinsert(ilist, where, INSTR_CREATE_add
+                             (drcontext,
+                              OPND_CREATE_MEM32(scratch1, offs),
+                              OPND_CREATE_INT8(1)));
+#else
+    if (offs >= 4096) {
+        /* past the reach of a load's immediate offset */
+        instrlist_insert_mov_immed_ptrsz(drcontext, offs, opnd_create_reg(scratch2),
+                                         ilist, where, NULL, NULL);
+        instrlist_meta_preinsert(ilist, where, XINST_CREATE_add
+                                 (drcontext,
+                                  opnd_create_reg(scratch1),
+                                  opnd_create_reg(scratch2)));
+        offs = 0;
+    }
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_load
+                             (drcontext,
+                              opnd_create_reg(scratch2),
+                              OPND_CREATE_MEM32(scratch1, offs)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_add
+                             (drcontext,
+                              opnd_create_reg(scratch2),
+                              OPND_CREATE_INT(1)));
+    instrlist_meta_preinsert(ilist, where, XINST_CREATE_store
+                             (drcontext,
+                              OPND_CREATE_MEM32(scratch1, offs),
+                              opnd_create_reg(scratch2)));
+#endif
+}
+
+void
+drtaint_stats_instrumented(instr_t *instr)
+{
+    dr_atomic_add32_return_sum(&static_counts[instr_get_opcode(instr)], 1);
+}
+
+void
+drtaint_stats_unimplemented(int opcode, bool simd)
+{
+    if (stats_path != NULL)
+        opcode_flags[opcode] = simd ? OPCODE_SIMD : OPCODE_UNIMPLEMENTED;
+}
+
+void
+drtaint_stats_callout(drtaint_stats_callout_t callout)
+{
+    if (stats_path != NULL)
+        dr_atomic_add32_return_sum(&callouts[callout], 1);
+}
+
+/* ======================================================================================
+ * report
+ * ==================================================================================== */
+typedef struct _opcode_totals_t {
+    uint64 clean;
+    uint64 tainted;
+} opcode_totals_t;
+
+static void
+write_report(opcode_totals_t *totals)
+{
+    uint64 unimpl_static = 0, unimpl_dynamic = 0, simd_static = 0, simd_dynamic = 0;
+    bool first = true;
+    file_t f;
+    int op;
+
+    f = dr_open_file(stats_path, DR_FILE_WRITE_OVERWRITE);
+    if (f == INVALID_FILE)
+        return;
+    for (op = 0; op < OP_LAST; op++) {
+        if (opcode_flags[op] == OPCODE_UNIMPLEMENTED) {
+            unimpl_static += static_counts[op];
+            unimpl_dynamic += totals[op].tainted;
+        } else if (opcode_flags[op] == OPCODE_SIMD) {
+            simd_static += static_counts[op];
+            simd_dynamic += totals[op].tainted;
+        }
+    }
+    dr_fprintf(f, "{\n  \"blocks\": %u,\n  \"blocks_uncounted\": %u,\n"
+               "  \"callouts\": {", num_blocks,
+               num_blocks > MAX_COUNTED ? num_blocks - MAX_COUNTED : 0);
+    for (int i = 0; i < DRTAINT_STATS_CALLOUT_COUNT; i++) {
+        dr_fprintf(f, "%s\"%s\": %d", i == 0 ? " " : ", ",
+                   callout_names[i], callouts[i]);
+    }
+    dr_fprintf(f, " },\n");
+    dr_fprintf(f, "  \"unimplemented\": { \"static\": " UINT64_FORMAT_STRING
+               ", \"dynamic\": " UINT64_FORMAT_STRING " },\n",
+               unimpl_static, unimpl_dynamic);
+    dr_fprintf(f, "  \"simd\": { \"static\": " UINT64_FORMAT_STRING
+               ", \"dynamic\": " UINT64_FORMAT_STRING " },\n",
+               simd_static, simd_dynamic);
+    dr_fprintf(f, "  \"opcodes\": [");
+    for (op = 0; op < OP_LAST; op++) {
+        if (static_counts[op] == 0 && totals[op].clean == 0 && totals[op].tainted == 0)
+            continue;
+        dr_fprintf(f, "%s\n    { \"name\": \"%s\", \"static\": %d, "
+                   "\"dynamic\": " UINT64_FORMAT_STRING ", "
+                   "\"dynamic_clean\": " UINT64_FORMAT_STRING ", "
+                   "\"unimplemented\": %s, \"simd\": %s }",
+                   first ? "" : ",", decode_opcode_name(op), static_counts[op],
+                   totals[op].tainted, totals[op].clean,
+                   opcode_flags[op] == OPCODE_UNIMPLEMENTED ? "true" : "false",
+                   opcode_flags[op] == OPCODE_SIMD ? "true" : "false");
+        first = false;
+    }
+    dr_fprintf(f, "\n  ]\n}\n");
+    dr_close_file(f);
+}
+
+void
+drtaint_stats_exit(void)
+{
+    opcode_totals_t *totals;
+    drtaint_stats_block_t *block, *next;
+
+    if (stats_path == NULL)
+        return;
+    /* Multiply each block's executions out over its opcodes. The tainted
+     * copy's count is the one that pays for propagation.
+     */
+    totals = dr_global_alloc(OP_LAST * sizeof(*totals));
+    memset(totals, 0, OP_LAST * sizeof(*totals));
+    for (uint i = 0; i < NUM_BUCKETS; i++) {
+        for (block = buckets[i]; block != NULL; block = block->next) {
+            for (uint j = 0; j < block->num_instrs; j++) {
+                totals[block->opcodes[j]].clean += block->execs[0];
+                totals[block->opcodes[j]].tainted += block->execs[1];
+            }
+        }
+    }
+    write_report(totals);
+    dr_global_free(totals, OP_LAST * sizeof(*totals));
+
+    for (uint i = 0; i < NUM_BUCKETS; i++) {
+        for (block = buckets[i]; block != NULL; block = next) {
+            next = block->next;
+            dr_global_free(block, BLOCK_BYTES(block->num_instrs));
+        }
+    }
+    dr_global_free(buckets, NUM_BUCKETS * sizeof(*buckets));
+    dr_global_free(static_counts, OP_LAST * sizeof(*static_counts));
+    dr_global_free(opcode_flags, OP_LAST * sizeof(*opcode_flags));
+    dr_mutex_destroy(table_lock);
+    drmgr_unregister_thread_init_event(event_thread_init);
+    drmgr_unregister_thread_exit_event(event_thread_exit);
+    drmgr_unregister_tls_field(tls_idx);
+    stats_path = NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef DRTAINT_STATS_H_
+#define DRTAINT_STATS_H_
+
+#include "dr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opcode statistics, gathered when drtaint_options_t.stats_path is set.
+ * Static counts are taken as app instructions are instrumented, and
+ * dynamic counts from one inline per-thread counter per block copy,
+ * multiplied out by the opcodes in the block when the report is written.
+ */
+
+/* The calls out of the code cache we count */
+typedef enum {
+    /* a load in the clean copy found taint and switched copies */
+    DRTAINT_STATS_CALLOUT_BAIL,
+    /* a DRTAINT_LABELS_SETS union missed the inline fast path */
+    DRTAINT_STATS_CALLOUT_UNION,
+    DRTAINT_STATS_CALLOUT_COUNT,
+} drtaint_stats_callout_t;
+
+typedef struct _drtaint_stats_block_t drtaint_stats_block_t;
+
+bool
+drtaint_stats_init(const char *path);
+
+/* Writes the JSON report and frees everything */
+void
+drtaint_stats_exit(void);
+
+bool
+drtaint_stats_enabled(void);
+
+/* Returns the counters of the block at tag, creating them from the app
+ * instructions in ilist the first time the block is seen.
+ */
+drtaint_stats_block_t *
+drtaint_stats_block(void *tag, instrlist_t *ilist);
+
+/* Returns the counters of an already seen block, or NULL */
+drtaint_stats_block_t *
+drtaint_stats_lookup(void *tag);
+
+/* Inserts an increment of the calling thread's executions of one copy of
+ * the block, without touching the flags on ARM. x86 callers hold them.
+ */
+void
+drtaint_stats_insert_block_count(void *drcontext, instrlist_t *ilist, instr_t *where,
+                                 drtaint_stats_block_t *block, uintptr_t encoding,
+                                 reg_id_t scratch1, reg_id_t scratch2);
+
+void
+drtaint_stats_instrumented(instr_t *instr);
+
+/* Marks the opcode as one drtaint does not propagate through or, with
+ * simd, as a SIMD opcode it propagates as the union of all its operands.
+ */
+void
+drtaint_stats_unimplemented(int opcode, bool simd);
+
+void
+drtaint_stats_callout(drtaint_stats_callout_t callout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+@ Shared prologue and epilogue for the handler kernels. Each kernel runs
+@ its body ITERS times on values derived from r5, which holds a pc value:
+@ under draslrharden reading pc taints r5, so the instrumented copy of
+@ each block runs, while under drtaint_only everything stays clean, so
+@ run.sh only times draslrharden.
+
+#ifndef ITERS
+#define ITERS 10000000
+#endif
+
+  .arch armv7-a
+  .syntax unified
+#ifdef THUMB
+  .thumb
+#else
+  .arm
+#endif
+  .section .text.startup,"ax",%progbits
+  .align 2
+  .global _start
+  .global _exit
+
+.macro BENCH_BEGIN
+#ifdef THUMB
+  .thumb_func
+#endif
+_start:
+  sub   sp, sp, #256
+  mov   r5, pc
+  mov   r0, r5
+  mov   r1, r5
+  mov   r2, r5
+  mov   r3, r5
+  add   r6, sp, #128
+  ldr   r4, =ITERS
+.Lloop:
+.endm
+
+.macro BENCH_END
+  subs  r4, r4, #1
+  bne   .Lloop
+  movs  r0, #0
+  bl    _exit
+  .ltorg
+.endm
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Runs each handler kernel natively and under draslrharden, whose tainted
+# pc reads make the instrumented copies run, and prints one JSON object
+# per kernel and ISA on stdout. drtaint_only taints nothing, so under it
+# the kernels would only measure the dispatch to their clean copies.
+#
+# usage: run.sh <drrun> <libdraslrharden.so> [runs]
+#
+# Set QEMU to a user-mode emulator such as qemu-arm to run on a non-ARM
+# host, and BENCH_DIR to where the kernels were built. Exits with 1 if
+# any run fails.
+
+DRRUN=${1:?usage: $0 <drrun> <libdraslrharden.so> [runs]}
+ASLR=${2:?usage: $0 <drrun> <libdraslrharden.so> [runs]}
+RUNS=${3:-3}
+BENCH_DIR=${BENCH_DIR:-$(dirname "$0")}
+KERNELS="ldr str arith mla umull ldm_stm"
+
+# prints the fastest of $RUNS wall times of the command, in seconds
+fastest()
+{
+    fastest=
+    i=0
+    while [ $i -lt $RUNS ]; do
+        start=$(date +%s.%N)
+        $QEMU "$@" > /dev/null 2>&1 || { echo "failed: $*" >&2; exit 1; }
+        end=$(date +%s.%N)
+        fastest=$(echo "$start $end $fastest" |
+                  awk '{ t = $2 - $1; if ($3 == "" || t < $3) print t; else print $3 }')
+        i=$((i + 1))
+    done
+    echo $fastest
+}
+
+for kernel in $KERNELS; do
+    for isa in arm thumb; do
+        bin="$BENCH_DIR/${kernel}_$isa"
+        native=$(fastest "$bin") || exit 1
+        secs=$(fastest "$DRRUN" -c "$ASLR" -- "$bin") || exit 1
+        echo "$kernel $isa draslrharden $native $secs" | awk '{
+            printf "{\"kernel\": \"%s\", \"isa\": \"%s\", \"client\": \"%s\", " \
+                   "\"native_s\": %.4f, \"client_s\": %.4f, \"slowdown\": %.2f}\n",
+                   $1, $2, $3, $4, $5, $5 / $4 }'
+    done
+done
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Compare the time and memory cost of each shadow granularity.
+#
+# usage: bench_granularity.sh <drrun> <libdrtaint.so> [runs]
+#
+# Each configuration compresses a copy of the bzip2 binary. The output is
+# one line per run: config, wall seconds, max resident set size in KB.
+
+DRRUN=${1:?usage: $0 <drrun> <libdrtaint.so> [runs]}
+CLIENT=${2:?usage: $0 <drrun> <libdrtaint.so> [runs]}
+RUNS=${3:-3}
+DIR=$(dirname "$0")
+BZIP2="$DIR/bzip2/bzip2"
+INPUT="$BZIP2"
+
+run()
+{
+    name=$1
+    shift
+    i=0
+    while [ $i -lt $RUNS ]; do
+        /usr/bin/time -f "$name %e %M" "$@" -c "$INPUT" > /dev/null 2>> /tmp/bench_granularity.$$
+        i=$((i + 1))
+    done
+}
+
+rm -f /tmp/bench_granularity.$$
+run native "$BZIP2"
+run word "$DRRUN" -c "$CLIENT" -granularity word -- "$BZIP2"
+run byte "$DRRUN" -c "$CLIENT" -granularity byte -- "$BZIP2"
+
+echo "config seconds max_rss_kb"
+grep -E '^(native|word|byte) ' /tmp/bench_granularity.$$
+rm -f /tmp/bench_granularity.$$
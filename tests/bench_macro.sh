@@ -0,0 +1,131 @@
+#!/bin/sh
+# Runs a fixed set of workloads natively, under drtaint_only and under
+# draslrharden, and compares wall time, peak RSS and shadow memory against
+# the committed baseline.
+#
+# usage: bench_macro.sh <drrun> <libdrtaint.so> <libdraslrharden.so> [--update]
+#
+# RUNS sets the runs per measurement (the fastest is kept), TOLERANCE the
+# percentage over baseline that counts as a regression, and BASELINE the
+# baseline file. --update rewrites the baseline from this run instead of
+# comparing, noting the board it ran on. Exits with 1 if anything
+# regressed or has no baseline to compare against, and with 2 if the
+# baseline holds no numbers at all, so an empty baseline never passes but
+# can be told apart from a regression.
+
+usage="usage: $0 <drrun> <libdrtaint.so> <libdraslrharden.so> [--update]"
+DRRUN=${1:?$usage}
+TAINT=${2:?$usage}
+ASLR=${3:?$usage}
+UPDATE=$4
+RUNS=${RUNS:-3}
+TOLERANCE=${TOLERANCE:-10}
+DIR=$(cd "$(dirname "$0")" && pwd)
+BASELINE=${BASELINE:-$DIR/bench_baseline.txt}
+WORK=$(mktemp -d)
+RESULTS=$WORK/results
+trap 'rm -rf "$WORK"' EXIT
+
+# Writes size bytes of deterministic, moderately compressible text to file
+gen_input()
+{
+    awk -v n="$2" 'BEGIN {
+        split("taint shadow label block register memory syscall leak " \
+              "stack heap pointer word byte client module trace", words);
+        x = 1;
+        while (len < n) {
+            x = (x * 1103515245 + 12345) % 2147483648;
+            w = words[int(x / 65536) % 16 + 1] (x % 7 == 0 ? "\n" : " ");
+            printf "%s", w;
+            len += length(w);
+        }
+    }' > "$1"
+}
+
+# Runs the command under a config RUNS times and records the fastest
+measure()
+{
+    name=$1
+    config=$2
+    shift 2
+    case $config in
+    native)       set -- "$@" ;;
+    drtaint)      set -- "$DRRUN" -c "$TAINT" -shadow_usage -- "$@" ;;
+    draslrharden) set -- "$DRRUN" -c "$ASLR" -- "$@" ;;
+    esac
+    i=0
+    while [ $i -lt $RUNS ]; do
+        /usr/bin/time -f "time %e %M" "$@" < "$STDIN" > /dev/null 2> "$WORK/err"
+        awk -v name="$name" -v config="$config" '
+            /^time / { secs = $2; rss = $3 }
+            /^drtaint shadow_kb / { shadow = $3 }
+            END { print name, config, secs, rss, (shadow == "" ? "-" : shadow) }
+        ' "$WORK/err" >> "$WORK/runs"
+        i=$((i + 1))
+    done
+}
+
+STDIN=/dev/null
+for size in 262144 1048576 4194304; do
+    gen_input "$WORK/input_$size" $size
+    "$DIR/bzip2/bzip2" -c < "$WORK/input_$size" > "$WORK/input_$size.bz2"
+done
+for config in native drtaint draslrharden; do
+    for size in 262144 1048576 4194304; do
+        STDIN=$WORK/input_$size
+        measure bzip2_compress_$size $config "$DIR/bzip2/bzip2" -c
+        STDIN=$WORK/input_$size.bz2
+        measure bzip2_decompress_$size $config "$DIR/bzip2/bzip2" -dc
+    done
+    STDIN=/dev/null
+    measure simple_argv $config "$DIR/simple_argv" a b c
+    measure simple $config "$DIR/simple/simple"
+    measure simple_thumb $config "$DIR/simple/simple_thumb"
+done
+
+# keep the fastest run of each workload and config
+sort -k1,1 -k2,2 -k3,3n "$WORK/runs" | awk '!seen[$1 " " $2]++' > "$RESULTS"
+
+if [ "$UPDATE" = "--update" ]; then
+    {
+        echo "# workload config seconds max_rss_kb shadow_kb"
+        echo "# recorded $(date -u +%Y-%m-%d) on $(uname -nm)"
+        cat "$RESULTS"
+    } > "$BASELINE"
+    cat "$RESULTS"
+    exit 0
+fi
+
+awk -v tol="$TOLERANCE" '
+    FNR == NR { if ($1 !~ /^#/) { base[$1 " " $2] = $0; recorded = 1 }; next }
+    !recorded {
+        print "no numbers in the baseline, record them on the reference board " \
+              "with --update" > "/dev/stderr"
+        exit 2
+    }
+    {
+        key = $1 " " $2
+        status = "ok"
+        if (!(key in base)) {
+            status = "NO-BASELINE"
+            failed = 1
+            missing = 1
+        } else {
+            split(base[key], b, " ")
+            if ($3 > b[3] * (1 + tol / 100) || $4 > b[4] * (1 + tol / 100) ||
+                ($5 != "-" && b[5] != "-" && $5 > b[5] * (1 + tol / 100))) {
+                status = "REGRESSION"
+                failed = 1
+            }
+        }
+        printf "%-24s %-13s %8s %10s %10s  %s\n", $1, $2, $3, $4, $5, status
+    }
+    END {
+        if (!recorded)
+            exit 2
+        if (missing)
+            print "no baseline for some workloads, record one on the reference " \
+                  "board with --update" > "/dev/stderr"
+        exit failed
+    }
+' "$BASELINE" "$RESULTS"
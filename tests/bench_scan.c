@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../drtaint_scan.h"
+
+/* Compares the shadow scanning kernels against a per-byte loop over a
+ * clean buffer, which is the common case for a sink and the worst case for
+ * the scan.
+ */
+
+static size_t
+first_nonzero_bytewise(const unsigned char *shadow, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size && shadow[i] == 0; i++)
+        ;
+    return i;
+}
+
+static unsigned char
+union_bytewise(const unsigned char *shadow, size_t size)
+{
+    unsigned char label = 0;
+    size_t i;
+    for (i = 0; i < size; i++)
+        label |= shadow[i];
+    return label;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define BENCH(name, expr)                                                 \
+    do {                                                                  \
+        double start = now();                                             \
+        for (i = 0; i < iters; i++)                                       \
+            sink += (expr);                                               \
+        double secs = now() - start;                                      \
+        printf("%-24s %10zu %10.3f\n", name, size,                        \
+               (double)size * iters / secs / (1 << 30));                  \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    size_t sizes[] = { 64, 4096, 65536, 1 << 20 };
+    volatile size_t sink = 0;
+    unsigned char *shadow;
+    size_t s, i;
+
+    shadow = calloc(1, 1 << 20);
+    if (shadow == NULL)
+        return 1;
+    printf("kernels: %s\n", drtaint_scan_kernel());
+    printf("%-24s %10s %10s\n", "kernel", "bytes", "GiB/s");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t size = sizes[s];
+        size_t iters = (argc > 1 ? atoi(argv[1]) : 256) * ((1 << 20) / size);
+
+        BENCH("first_nonzero_bytewise", first_nonzero_bytewise(shadow, size));
+        BENCH("first_nonzero", drtaint_scan_first_nonzero(shadow, size));
+        BENCH("union_bytewise", union_bytewise(shadow, size));
+        BENCH("union", drtaint_scan_union(shadow, size));
+    }
+
+    /* check the kernels agree with the loops at every offset */
+    for (i = 0; i < 300; i++) {
+        memset(shadow, 0, 300);
+        shadow[i] = 1 << (i % 8);
+        if (drtaint_scan_first_nonzero(shadow, 300) != i ||
+            drtaint_scan_union(shadow, 300) != union_bytewise(shadow, 300)) {
+            printf("mismatch at %zu\n", i);
+            return 1;
+        }
+    }
+    free(shadow);
+    return 0;
+}